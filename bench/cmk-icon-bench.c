@@ -0,0 +1,650 @@
+/*
+ * libcmk
+ * Copyright (C) 2017 Velt Technologies, Aidan Shafran <zelbrium@gmail.com>
+ * Licensed under the Apache License 2 <www.apache.org/licenses/LICENSE-2.0>.
+ */
+
+/*
+ * cmk-icon-bench generates synthetic XDG icon themes in a temporary
+ * directory and times CmkIconLoader against them, so that loader changes
+ * can be compared without depending on whatever themes are installed.
+ *
+ * The generated themes are bench-0 (the default theme) inheriting from
+ * bench-1, and so on down to bench-<depth-1>, which inherits hicolor.
+ * Each theme only contains its own icons, named icon-<theme>-<n>, with
+ * hicolor's named icon-hicolor-<n>. So a lookup of icon-0-<n> is a hit in
+ * the default theme, icon-hicolor-<n> has to fall back through every
+ * theme, and anything else is a miss.
+ *
+ * The themes are put in $HOME/.icons with $HOME pointed at the temporary
+ * directory, which the loader searches before the system themes.
+ *
+ * With --theme, nothing is generated, and the scan of an installed theme
+ * (such as Adwaita, hicolor or Papirus) and its inherited themes is timed
+ * instead. With --png-dir, every PNG under a directory (such as an
+ * installed theme's) is decoded with cairo's PNG loader and with the
+ * loader's own libpng decoder, and the two are timed and compared.
+ */
+
+#include "cmk-icon-loader.h"
+#include "cmk-icon-raster-private.h"
+#include <glib/gstdio.h>
+#include <librsvg/rsvg.h>
+#include <stdio.h>
+#include <string.h>
+
+static gint numDirs = 20;
+static gint numIcons = 200;
+static gint depth = 3;
+static gint svgPercent = 50;
+static gint numLookups = 100000;
+static gint numDecodes = 200;
+static gboolean useDiskCache = FALSE;
+static gboolean keep = FALSE;
+static gchar *installedTheme = NULL;
+static gchar *pngDir = NULL;
+
+static GOptionEntry entries[] =
+{
+	{"dirs", 'd', 0, G_OPTION_ARG_INT, &numDirs, "Directories per theme (default 20)", "N"},
+	{"icons", 'i', 0, G_OPTION_ARG_INT, &numIcons, "Icons per theme (default 200)", "N"},
+	{"depth", 'D', 0, G_OPTION_ARG_INT, &depth, "Themes in the inheritance chain, not counting hicolor (default 3)", "N"},
+	{"svg", 's', 0, G_OPTION_ARG_INT, &svgPercent, "Percentage of icons that are SVGs (default 50)", "PERCENT"},
+	{"lookups", 'l', 0, G_OPTION_ARG_INT, &numLookups, "Lookups per throughput test (default 100000)", "N"},
+	{"decodes", 'n', 0, G_OPTION_ARG_INT, &numDecodes, "Icons to decode per format (default 200)", "N"},
+	{"disk-cache", 0, 0, G_OPTION_ARG_NONE, &useDiskCache, "Leave the on-disk SVG cache enabled", NULL},
+	{"keep", 'k', 0, G_OPTION_ARG_NONE, &keep, "Don't delete the generated themes", NULL},
+	{"theme", 't', 0, G_OPTION_ARG_STRING, &installedTheme, "Time an installed theme instead of generated ones", "NAME"},
+	{"png-dir", 0, 0, G_OPTION_ARG_FILENAME, &pngDir, "Time cairo's PNG decoder against the loader's on every PNG under DIR", "DIR"},
+	{NULL}
+};
+
+// Fixed directory sizes. Each cycle through these adds a Scalable
+// directory, and every other cycle is @2x.
+static const guint dirSizes[] = {16, 22, 24, 32, 48, 64, 96, 128, 256};
+#define NUM_DIR_SIZES G_N_ELEMENTS(dirSizes)
+#define DIR_CYCLE (NUM_DIR_SIZES + 1)
+
+typedef struct
+{
+	guint size;
+	guint scale;
+	gboolean scalable;
+	gchar *where;
+} BenchDir;
+
+static GHashTable *pngTemplates = NULL; // Pixel size -> GBytes
+
+static gint64 now_us(void)
+{
+	return g_get_monotonic_time();
+}
+
+static gdouble ms_since(gint64 start)
+{
+	return (now_us() - start) / 1000.0;
+}
+
+static glong rss_kb(void)
+{
+	gchar *status = NULL;
+	if(!g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+		return 0;
+	glong kb = 0;
+	const gchar *line = strstr(status, "VmRSS:");
+	if(line)
+		sscanf(line, "VmRSS: %ld", &kb);
+	g_free(status);
+	return kb;
+}
+
+static cairo_status_t append_png_data(GByteArray *array, const guchar *data, guint length)
+{
+	g_byte_array_append(array, data, length);
+	return CAIRO_STATUS_SUCCESS;
+}
+
+static GBytes * get_png_template(guint pixelSize)
+{
+	GBytes *bytes = g_hash_table_lookup(pngTemplates, GUINT_TO_POINTER(pixelSize));
+	if(bytes)
+		return bytes;
+
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, pixelSize, pixelSize);
+	cairo_t *cr = cairo_create(surface);
+	cairo_arc(cr, pixelSize/2.0, pixelSize/2.0, pixelSize/2.0, 0, 2*G_PI);
+	cairo_set_source_rgba(cr, 0.2, 0.4, 0.8, 0.9);
+	cairo_fill(cr);
+	cairo_destroy(cr);
+
+	GByteArray *array = g_byte_array_new();
+	cairo_surface_write_to_png_stream(surface, (cairo_write_func_t)append_png_data, array);
+	cairo_surface_destroy(surface);
+
+	bytes = g_byte_array_free_to_bytes(array);
+	g_hash_table_insert(pngTemplates, GUINT_TO_POINTER(pixelSize), bytes);
+	return bytes;
+}
+
+static gchar * make_svg(guint size)
+{
+	return g_strdup_printf(
+		"<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%u\" height=\"%u\" viewBox=\"0 0 16 16\">"
+		"<path d=\"M8 1a7 7 0 1 0 0 14A7 7 0 0 0 8 1zm0 3a4 4 0 1 1 0 8 4 4 0 0 1 0-8z\" fill=\"#36c\"/>"
+		"<rect x=\"6\" y=\"6\" width=\"4\" height=\"4\" rx=\"1\" fill=\"#c63\" opacity=\"0.8\"/>"
+		"</svg>", size, size);
+}
+
+static BenchDir * make_dirs(void)
+{
+	BenchDir *dirs = g_new0(BenchDir, numDirs);
+	for(gint d=0;d<numDirs;++d)
+	{
+		guint slot = d % DIR_CYCLE;
+		dirs[d].scale = 1 + (d / DIR_CYCLE) % 2;
+		dirs[d].scalable = (slot == NUM_DIR_SIZES);
+		dirs[d].size = dirs[d].scalable ? 48 : dirSizes[slot];
+		const gchar *scaleSuffix = (dirs[d].scale > 1) ? "@2" : "";
+		if(dirs[d].scalable)
+			dirs[d].where = g_strdup_printf("scalable%s/ctx%d", scaleSuffix, d / (DIR_CYCLE*2));
+		else
+			dirs[d].where = g_strdup_printf("%ux%u%s/ctx%d", dirs[d].size, dirs[d].size, scaleSuffix, d / (DIR_CYCLE*2));
+	}
+	return dirs;
+}
+
+static gboolean icon_is_svg(gint n)
+{
+	return (n * 37) % 100 < svgPercent;
+}
+
+/*
+ * The loader keeps parsed SVG documents and decoded surfaces for every
+ * process, with no way to flush them, so each timed SVG pass decodes its
+ * own third of the icons. Otherwise a later pass could find an earlier
+ * one's documents still cached and leave parsing out of its timings.
+ */
+#define NUM_SVG_PASSES 3
+
+static gboolean svg_pass_has_icon(gint pass, gint n)
+{
+	return n % NUM_SVG_PASSES == pass;
+}
+
+static guint generate_theme(const gchar *root, const gchar *name, const gchar *inherits, const BenchDir *dirs)
+{
+	gchar *themeDir = g_build_filename(root, name, NULL);
+	g_mkdir_with_parents(themeDir, 0755);
+
+	GString *index = g_string_new("[Icon Theme]\n");
+	g_string_append_printf(index, "Name=%s\nComment=cmk-icon-bench synthetic theme\n", name);
+	if(inherits)
+		g_string_append_printf(index, "Inherits=%s\n", inherits);
+	g_string_append(index, "Directories=");
+	for(gint d=0;d<numDirs;++d)
+		g_string_append_printf(index, "%s%s", dirs[d].where, (d == numDirs-1) ? "\n" : ",");
+
+	for(gint d=0;d<numDirs;++d)
+	{
+		g_string_append_printf(index, "\n[%s]\nSize=%u\nScale=%u\nContext=Applications\n", dirs[d].where, dirs[d].size, dirs[d].scale);
+		if(dirs[d].scalable)
+			g_string_append(index, "Type=Scalable\nMinSize=8\nMaxSize=512\n");
+		else
+			g_string_append(index, "Type=Threshold\n");
+	}
+
+	gchar *indexPath = g_build_filename(themeDir, "index.theme", NULL);
+	g_file_set_contents(indexPath, index->str, index->len, NULL);
+	g_free(indexPath);
+	g_string_free(index, TRUE);
+
+	// Every icon is in all directories of the same context, like a real
+	// theme providing each icon at several sizes.
+	guint numFiles = 0;
+	gint numContexts = (numDirs + DIR_CYCLE*2 - 1) / (DIR_CYCLE*2);
+	for(gint d=0;d<numDirs;++d)
+	{
+		gchar *dirPath = g_build_filename(themeDir, dirs[d].where, NULL);
+		g_mkdir_with_parents(dirPath, 0755);
+		gint context = d / (DIR_CYCLE*2);
+		for(gint n=context;n<numIcons;n+=numContexts)
+		{
+			gboolean svg = dirs[d].scalable || icon_is_svg(n);
+			gchar *file = g_strdup_printf("%s/icon-%s-%d.%s", dirPath, name + (g_str_has_prefix(name, "bench-") ? 6 : 0), n, svg ? "svg" : "png");
+			if(svg)
+			{
+				gchar *data = make_svg(dirs[d].size * dirs[d].scale);
+				g_file_set_contents(file, data, -1, NULL);
+				g_free(data);
+			}
+			else
+			{
+				gsize length;
+				GBytes *png = get_png_template(dirs[d].size * dirs[d].scale);
+				const gchar *data = g_bytes_get_data(png, &length);
+				g_file_set_contents(file, data, length, NULL);
+			}
+			g_free(file);
+			++numFiles;
+		}
+		g_free(dirPath);
+	}
+
+	g_free(themeDir);
+	return numFiles;
+}
+
+static void remove_recursive(const gchar *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if(dir)
+	{
+		const gchar *entry;
+		while((entry = g_dir_read_name(dir)))
+		{
+			gchar *child = g_build_filename(path, entry, NULL);
+			remove_recursive(child);
+			g_free(child);
+		}
+		g_dir_close(dir);
+	}
+	g_remove(path);
+}
+
+static gchar ** make_names(const gchar *prefix, gint count)
+{
+	gchar **names = g_new0(gchar *, count + 1);
+	for(gint i=0;i<count;++i)
+		names[i] = g_strdup_printf("%s-%d", prefix, i % MAX(numIcons, 1));
+	return names;
+}
+
+/*
+ * Runs numLookups lookups cycling through names, at cycling sizes.
+ * Returns the number that were found.
+ */
+static gint run_lookups(CmkIconLoader *loader, gchar **names, gint numNames, gdouble *elapsedMs)
+{
+	static const guint sizes[] = {16, 24, 32, 48, 64};
+	gint found = 0;
+	gint64 start = now_us();
+	for(gint i=0;i<numLookups;++i)
+	{
+		gchar *path = cmk_icon_loader_lookup_full(loader, names[i % numNames], FALSE, NULL, TRUE, sizes[i % G_N_ELEMENTS(sizes)], 1);
+		if(path)
+			++found;
+		g_free(path);
+	}
+	*elapsedMs = ms_since(start);
+	return found;
+}
+
+static void print_lookups(const gchar *what, gint found, gdouble ms)
+{
+	printf("  %-10s %9.0f lookups/s  (%.3f us each, %d/%d found)\n",
+		what, numLookups / (ms / 1000.0), ms * 1000.0 / numLookups, found, numLookups);
+}
+
+static void bench_decodes(CmkIconLoader *loader, guint size, gboolean svg, gint svgPass)
+{
+	gint decoded = 0;
+	gdouble totalMs = 0;
+	for(gint n=0;n<numIcons && decoded<numDecodes;++n)
+	{
+		if(icon_is_svg(n) != svg || (svg && !svg_pass_has_icon(svgPass, n)))
+			continue;
+		gchar *name = g_strdup_printf("icon-0-%d", n);
+		gchar *path = cmk_icon_loader_lookup_full(loader, name, FALSE, NULL, FALSE, size, 1);
+		g_free(name);
+		if(!path)
+			continue;
+
+		gint64 start = now_us();
+		cairo_surface_t *surface = cmk_icon_loader_load(loader, path, size, 1, FALSE);
+		totalMs += ms_since(start);
+		if(surface)
+		{
+			cairo_surface_destroy(surface);
+			++decoded;
+		}
+		g_free(path);
+	}
+
+	if(decoded > 0)
+		printf("  %s @%-4u %8.3f ms each  (%d icons)\n", svg ? "SVG" : "PNG", size, totalMs / decoded, decoded);
+	else
+		printf("  %s @%-4u no icons\n", svg ? "SVG" : "PNG", size);
+}
+
+/*
+ * Splits the cost of an SVG into parsing and rasterizing, first with
+ * librsvg directly and then through the loader, which keeps parsed
+ * documents around so that each size after the first only rasterizes.
+ */
+static void bench_svg_split(CmkIconLoader *loader, gint svgPass)
+{
+	static const guint sizes[] = {16, 24, 48};
+	gint count = 0;
+	gdouble parseMs = 0, renderMs = 0, firstMs = 0, extraMs = 0;
+	for(gint n=0;n<numIcons && count<numDecodes;++n)
+	{
+		if(!icon_is_svg(n) || !svg_pass_has_icon(svgPass, n))
+			continue;
+		gchar *name = g_strdup_printf("icon-0-%d", n);
+		gchar *path = cmk_icon_loader_lookup_full(loader, name, FALSE, NULL, FALSE, 48, 1);
+		g_free(name);
+		if(!path || !g_str_has_suffix(path, ".svg"))
+		{
+			g_free(path);
+			continue;
+		}
+
+		gint64 start = now_us();
+		RsvgHandle *handle = rsvg_handle_new_from_file(path, NULL);
+		parseMs += ms_since(start);
+		if(handle)
+		{
+			start = now_us();
+			cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 48, 48);
+			cairo_t *cr = cairo_create(surface);
+			rsvg_handle_render_cairo(handle, cr);
+			cairo_destroy(cr);
+			cairo_surface_destroy(surface);
+			renderMs += ms_since(start);
+			g_object_unref(handle);
+		}
+
+		for(guint i=0;i<G_N_ELEMENTS(sizes);++i)
+		{
+			start = now_us();
+			cairo_surface_t *surface = cmk_icon_loader_load(loader, path, sizes[i], 1, FALSE);
+			gdouble ms = ms_since(start);
+			if(i == 0)
+				firstMs += ms;
+			else
+				extraMs += ms;
+			if(surface)
+				cairo_surface_destroy(surface);
+		}
+		g_free(path);
+		++count;
+	}
+
+	if(count == 0)
+	{
+		printf("  no icons\n");
+		return;
+	}
+	printf("  parse      %8.3f ms each\n", parseMs / count);
+	printf("  render @48 %8.3f ms each\n", renderMs / count);
+	printf("  loader, first size  %8.3f ms each\n", firstMs / count);
+	printf("  loader, extra sizes %8.3f ms each  (%d icons)\n", extraMs / (count * (G_N_ELEMENTS(sizes) - 1)), count);
+}
+
+/*
+ * Times the first lookups in an installed theme. The miss reads every
+ * directory of the theme and of everything it inherits, which is the
+ * most a lookup can ever have to read. Each theme's best block of
+ * groups is read first, then the rest of its groups all in parallel.
+ */
+static int bench_installed_theme(const gchar *theme)
+{
+	static const gchar *names[] = {"folder", "text-x-generic", "user-home", "application-x-executable", "no-such-icon"};
+
+	CmkIconLoader *loader = cmk_icon_loader_new();
+	cmk_icon_loader_set_scale(loader, 1);
+	cmk_icon_loader_set_default_theme(loader, theme);
+	cmk_icon_loader_set_use_shared_cache(loader, FALSE);
+
+	printf("Installed theme %s\n", theme);
+	glong rssStart = rss_kb();
+	gint64 start = now_us();
+	gchar *path = cmk_icon_loader_lookup_full(loader, names[0], FALSE, NULL, TRUE, 48, 1);
+	printf("  first hit  %8.3f ms  (%s)\n", ms_since(start), path ? path : "not found");
+	g_free(path);
+
+	start = now_us();
+	path = cmk_icon_loader_lookup_full(loader, "cmk-icon-bench-no-such-icon", FALSE, NULL, TRUE, 48, 1);
+	printf("  full scan  %8.3f ms  (a miss, reading every directory in the inheritance chain)\n", ms_since(start));
+	g_free(path);
+	printf("  RSS +%ld KiB\n\n", rss_kb() - rssStart);
+
+	printf("Lookups (warm)\n");
+	gdouble ms;
+	gint found = run_lookups(loader, (gchar **)names, G_N_ELEMENTS(names), &ms);
+	print_lookups("mixed", found, ms);
+
+	g_object_unref(loader);
+	return 0;
+}
+
+static void find_pngs(const gchar *path, GPtrArray *paths)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if(!dir)
+	{
+		if(g_str_has_suffix(path, ".png") && g_file_test(path, G_FILE_TEST_IS_REGULAR))
+			g_ptr_array_add(paths, g_strdup(path));
+		return;
+	}
+	const gchar *entry;
+	while((entry = g_dir_read_name(dir)))
+	{
+		gchar *child = g_build_filename(path, entry, NULL);
+		if(!g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+			find_pngs(child, paths);
+		g_free(child);
+	}
+	g_dir_close(dir);
+}
+
+static gboolean surfaces_equal(cairo_surface_t *a, cairo_surface_t *b)
+{
+	gint width = cairo_image_surface_get_width(a);
+	gint height = cairo_image_surface_get_height(a);
+	if(width != cairo_image_surface_get_width(b) || height != cairo_image_surface_get_height(b)
+	|| cairo_image_surface_get_format(b) != CAIRO_FORMAT_ARGB32)
+		return FALSE;
+	cairo_surface_flush(a);
+	cairo_surface_flush(b);
+	for(gint y=0;y<height;++y)
+	{
+		const guint32 *rowA = (const guint32 *)(cairo_image_surface_get_data(a) + y * cairo_image_surface_get_stride(a));
+		const guint32 *rowB = (const guint32 *)(cairo_image_surface_get_data(b) + y * cairo_image_surface_get_stride(b));
+		for(gint x=0;x<width;++x)
+		{
+			// Cairo loads opaque images as RGB24, with the alpha byte unset
+			guint32 pa = rowA[x], pb = rowB[x];
+			if(cairo_image_surface_get_format(a) == CAIRO_FORMAT_RGB24)
+				pa |= 0xFF000000;
+			if(pa != pb)
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Times cairo_image_surface_create_from_png, which is what icons were
+ * decoded with before, against cmk_raster_decode_png on real PNGs. The
+ * files are read once first, so both decoders find them in the page
+ * cache.
+ */
+static int bench_png_dir(const gchar *path)
+{
+	GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+	find_pngs(path, paths);
+	if(paths->len == 0)
+	{
+		g_printerr("No PNGs found under %s\n", path);
+		g_ptr_array_unref(paths);
+		return 1;
+	}
+
+	guint64 bytes = 0, pixels = 0;
+	for(guint i=0;i<paths->len;++i)
+	{
+		gchar *data;
+		gsize length;
+		if(g_file_get_contents(g_ptr_array_index(paths, i), &data, &length, NULL))
+		{
+			bytes += length;
+			g_free(data);
+		}
+	}
+	printf("%u PNGs under %s, %.1f MiB\n", paths->len, path, bytes / (1024.0 * 1024.0));
+
+	gdouble cairoMs = 0, cmkMs = 0;
+	guint cairoFailed = 0, cmkFailed = 0, differing = 0;
+	for(guint i=0;i<paths->len;++i)
+	{
+		const gchar *file = g_ptr_array_index(paths, i);
+		gint64 start = now_us();
+		cairo_surface_t *reference = cairo_image_surface_create_from_png(file);
+		cairoMs += ms_since(start);
+
+		start = now_us();
+		cairo_surface_t *surface = cmk_raster_decode_png(file);
+		cmkMs += ms_since(start);
+
+		gboolean referenceOk = (cairo_surface_status(reference) == CAIRO_STATUS_SUCCESS);
+		if(!referenceOk)
+			++cairoFailed;
+		if(!surface)
+			++cmkFailed;
+		if(referenceOk && surface)
+		{
+			pixels += (guint64)cairo_image_surface_get_width(surface) * cairo_image_surface_get_height(surface);
+			if(!surfaces_equal(reference, surface))
+				++differing;
+		}
+		cairo_surface_destroy(reference);
+		if(surface)
+			cairo_surface_destroy(surface);
+	}
+
+	printf("  cairo  %9.3f ms  (%.3f ms each, %u failed)\n", cairoMs, cairoMs / paths->len, cairoFailed);
+	printf("  cmk    %9.3f ms  (%.3f ms each, %u failed)\n", cmkMs, cmkMs / paths->len, cmkFailed);
+	printf("  %.2fx, %.1f Mpx decoded by both, %u with different pixels\n",
+		cmkMs > 0 ? cairoMs / cmkMs : 0, pixels / 1e6, differing);
+	g_ptr_array_unref(paths);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context = g_option_context_new("- benchmark CmkIconLoader on synthetic icon themes");
+	g_option_context_add_main_entries(context, entries, NULL);
+	GError *error = NULL;
+	if(!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if(numDirs < 1 || numIcons < 1 || depth < 1 || svgPercent < 0 || svgPercent > 100 || numLookups < 1 || numDecodes < 0)
+	{
+		g_printerr("Invalid option value\n");
+		return 1;
+	}
+
+	// Installed themes are found through the real $HOME
+	if(installedTheme)
+		return bench_installed_theme(installedTheme);
+	if(pngDir)
+		return bench_png_dir(pngDir);
+
+	// Both must be set before GLib or the loader first read them
+	gchar *root = g_dir_make_tmp("cmk-icon-bench-XXXXXX", &error);
+	if(!root)
+	{
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_setenv("HOME", root, TRUE);
+	if(!useDiskCache)
+		g_setenv("CMK_ICON_DISK_CACHE", "0", TRUE);
+
+	gchar *iconsDir = g_build_filename(root, ".icons", NULL);
+	pngTemplates = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_bytes_unref);
+	BenchDir *dirs = make_dirs();
+
+	printf("Generating %d themes + hicolor, %d dirs and %d icons each, %d%% SVG, in %s\n",
+		depth, numDirs, numIcons, svgPercent, root);
+	gint64 start = now_us();
+	guint numFiles = 0;
+	for(gint t=0;t<depth;++t)
+	{
+		gchar *name = g_strdup_printf("bench-%d", t);
+		gchar *inherits = (t+1 < depth) ? g_strdup_printf("bench-%d", t+1) : g_strdup("hicolor");
+		numFiles += generate_theme(iconsDir, name, inherits, dirs);
+		g_free(inherits);
+		g_free(name);
+	}
+	numFiles += generate_theme(iconsDir, "hicolor", NULL, dirs);
+	printf("  %u files in %.1f ms\n\n", numFiles, ms_since(start));
+
+	glong rssStart = rss_kb();
+	CmkIconLoader *loader = cmk_icon_loader_new();
+	cmk_icon_loader_set_scale(loader, 1);
+	cmk_icon_loader_set_default_theme(loader, "bench-0");
+	cmk_icon_loader_set_use_shared_cache(loader, FALSE);
+
+	printf("Theme load\n");
+	start = now_us();
+	gchar *path = cmk_icon_loader_lookup_full(loader, "icon-0-0", FALSE, NULL, TRUE, 48, 1);
+	printf("  first hit  %8.3f ms  (index.theme parse and best directories)\n", ms_since(start));
+	g_free(path);
+
+	start = now_us();
+	path = cmk_icon_loader_lookup_full(loader, "no-such-icon", FALSE, NULL, TRUE, 48, 1);
+	printf("  first miss %8.3f ms  (reads every remaining directory of every theme, in parallel once its best block misses)\n", ms_since(start));
+	g_free(path);
+	printf("  RSS +%ld KiB\n\n", rss_kb() - rssStart);
+
+	printf("Lookups (warm)\n");
+	gint numNames = MIN(numLookups, numIcons);
+	gchar **hits = make_names("icon-0", numNames);
+	gchar **fallbacks = make_names("icon-hicolor", numNames);
+	gchar **misses = make_names("missing", numNames);
+	gdouble ms;
+	gint found = run_lookups(loader, hits, numNames, &ms);
+	print_lookups("hits", found, ms);
+	found = run_lookups(loader, fallbacks, numNames, &ms);
+	print_lookups("fallbacks", found, ms);
+	found = run_lookups(loader, misses, numNames, &ms);
+	print_lookups("misses", found, ms);
+	g_strfreev(hits);
+	g_strfreev(fallbacks);
+	g_strfreev(misses);
+	printf("\n");
+
+	printf("Decodes (uncached)\n");
+	bench_decodes(loader, 48, FALSE, 0);
+	bench_decodes(loader, 48, TRUE, 0);
+	bench_decodes(loader, 256, FALSE, 0);
+	bench_decodes(loader, 256, TRUE, 1);
+	printf("\n");
+
+	printf("SVG parse/render\n");
+	bench_svg_split(loader, 2);
+	printf("  RSS +%ld KiB total\n", rss_kb() - rssStart);
+
+	g_object_unref(loader);
+	for(gint d=0;d<numDirs;++d)
+		g_free(dirs[d].where);
+	g_free(dirs);
+	g_hash_table_unref(pngTemplates);
+
+	if(keep)
+		printf("\nThemes kept in %s\n", iconsDir);
+	else
+		remove_recursive(root);
+	g_free(iconsDir);
+	g_free(root);
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * libcmk
+ * Copyright (C) 2017 Velt Technologies, Aidan Shafran <zelbrium@gmail.com>
+ * Licensed under the Apache License 2 <www.apache.org/licenses/LICENSE-2.0>.
+ */
+
+#ifndef __CMK_ICON_CACHE_PRIVATE_H__
+#define __CMK_ICON_CACHE_PRIVATE_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+/*
+ * Raster caches that live outside of the process, used by CmkIconLoader.
+ * Rasters are stored as files holding a small header followed by the raw
+ * cairo pixel data, so that a hit is an mmap instead of a decode. Surfaces
+ * returned from these caches are backed by read-only mappings and must
+ * not be drawn to. All functions are thread safe. Not installed.
+ */
+
+G_BEGIN_DECLS
+
+/*
+ * Builds the key a raster is stored under: the file's path, its mtime,
+ * the pixel size it was loaded at and the format. Returns %NULL if the
+ * file can't be stat'd.
+ */
+G_GNUC_INTERNAL
+gchar * cmk_icon_cache_make_key(const gchar *path, guint size, cairo_format_t format);
+
+/*
+ * The shared cache lets every cmk process of the same user share decoded
+ * icons. It lives in $XDG_RUNTIME_DIR (normally a tmpfs, so in memory)
+ * and consists of an mmapped index and one file per raster. The index is
+ * a fixed open-addressing hash table updated only with atomic
+ * compare-and-swap, and segment files are published by atomic rename, so
+ * no process ever takes a lock to read or write the cache. Since it takes
+ * up RAM, it is capped at a fixed size, trimmed least recently used
+ * first, and slots of trimmed files are reused.
+ */
+G_GNUC_INTERNAL
+cairo_surface_t * cmk_icon_cache_shared_lookup(const gchar *key);
+G_GNUC_INTERNAL
+void cmk_icon_cache_shared_store(const gchar *key, cairo_surface_t *surface);
+
+/*
+ * The disk cache keeps rasterized SVGs across runs, in
+ * $XDG_CACHE_HOME/cmk, so that an app's second launch can paint its
+ * icons without librsvg. It is capped at a fixed size, trimmed least
+ * recently used first. Set CMK_ICON_DISK_CACHE=0 to disable it.
+ */
+G_GNUC_INTERNAL
+cairo_surface_t * cmk_icon_cache_disk_lookup(const gchar *key);
+G_GNUC_INTERNAL
+void cmk_icon_cache_disk_store(const gchar *key, cairo_surface_t *surface);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,582 @@
+/*
+ * libcmk
+ * Copyright (C) 2017 Velt Technologies, Aidan Shafran <zelbrium@gmail.com>
+ * Licensed under the Apache License 2 <www.apache.org/licenses/LICENSE-2.0>.
+ */
+
+#include "cmk-icon-cache-private.h"
+#include <glib/gstdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RASTER_MAGIC 0x494b4d43 // "CMKI"
+#define RASTER_DATA_ALIGN 64
+
+/*
+ * Layout of a raster file. The key follows the header, and the pixel
+ * data starts at dataOffset, which is aligned to RASTER_DATA_ALIGN.
+ */
+typedef struct
+{
+	guint32 magic;
+	guint32 format; // cairo_format_t
+	guint32 width;
+	guint32 height;
+	guint32 stride;
+	guint32 keyLength;
+	guint32 dataOffset;
+	guint32 reserved;
+} RasterHeader;
+
+typedef struct
+{
+	gpointer addr;
+	gsize length;
+} RasterMapping;
+
+static const cairo_user_data_key_t mappingKey;
+
+#define SHARED_DIR_NAME "cmk-icon-cache-1"
+#define INDEX_MAGIC 0x58444e49 // "INDX"
+#define INDEX_SLOTS 16384
+#define INDEX_MAX_PROBES 32
+#define INDEX_EMPTY 0
+#define INDEX_TOMBSTONE 1
+// The shared cache is in RAM, so it is capped well below the disk cache
+#define SHARED_CACHE_CAP (32*1024*1024) // Bytes
+#define SHARED_TOUCH_INTERVAL 60 // Seconds
+
+/*
+ * The shared index. Each slot holds the 32 bit hash of a key whose raster
+ * file exists, INDEX_EMPTY, or INDEX_TOMBSTONE for a slot whose file has
+ * been deleted. Slots only change with a compare-and-swap, so readers
+ * never see a partially written entry. Tombstones keep later entries of
+ * a probe sequence reachable, and are reused by stores.
+ */
+typedef struct
+{
+	gint magic;
+	gint numSlots;
+	gint slots[INDEX_SLOTS];
+} SharedIndex;
+
+typedef struct
+{
+	gchar *dir;
+	SharedIndex *index; // mmapped
+	gint trimming;
+	gint bytesSinceTrim;
+} SharedCache;
+
+#define DISK_DIR_NAME "icons-1"
+#define DISK_CACHE_CAP (64*1024*1024) // Bytes
+// Hits refresh a file's mtime (its LRU age) at most this often
+#define DISK_TOUCH_INTERVAL (24*60*60) // Seconds
+
+// Temporary files older than this were left by a writer that crashed
+#define TEMP_FILE_MAX_AGE 60 // Seconds
+
+typedef struct
+{
+	gchar *dir;
+	gint trimming;
+	gint bytesSinceTrim;
+} DiskCache;
+
+
+
+gchar * cmk_icon_cache_make_key(const gchar *path, guint size, cairo_format_t format)
+{
+	GStatBuf st;
+	if(!path || g_stat(path, &st) != 0)
+		return NULL;
+	return g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%u\n%d", path, (gint64)st.st_mtime, size, format);
+}
+
+static void unmap_raster(RasterMapping *mapping)
+{
+	munmap(mapping->addr, mapping->length);
+	g_free(mapping);
+}
+
+/*
+ * Maps a raster file and wraps its pixels in a surface, if the file is
+ * valid and was stored under the same key (keys are only hashed for file
+ * names and index slots, so collisions are caught here). A file whose
+ * mtime is over touchInterval seconds old has it updated, which is what
+ * trimming goes by.
+ */
+static cairo_surface_t * map_raster_file(const gchar *path, const gchar *key, gint64 touchInterval)
+{
+	int fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+	if(fd < 0)
+		return NULL;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(RasterHeader))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	if(st.st_mtime + touchInterval < time(NULL))
+		futimens(fd, NULL);
+
+	gsize length = st.st_size;
+	guchar *addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED)
+		return NULL;
+
+	const RasterHeader *header = (const RasterHeader *)addr;
+	gsize keyLength = strlen(key);
+	gboolean valid = header->magic == RASTER_MAGIC
+		&& (header->format == CAIRO_FORMAT_ARGB32 || header->format == CAIRO_FORMAT_A8)
+		&& header->keyLength == keyLength
+		&& sizeof(RasterHeader) + keyLength <= length
+		&& memcmp(addr + sizeof(RasterHeader), key, keyLength) == 0
+		&& header->stride == (guint32)cairo_format_stride_for_width(header->format, header->width)
+		&& header->dataOffset % RASTER_DATA_ALIGN == 0
+		&& header->dataOffset + (gsize)header->stride * header->height <= length;
+	if(!valid)
+	{
+		munmap(addr, length);
+		return NULL;
+	}
+
+	// The mapping is read-only; cairo will only ever read from it as long
+	// as nobody draws to the surface, which the loader forbids anyway.
+	cairo_surface_t *surface = cairo_image_surface_create_for_data(addr + header->dataOffset,
+		header->format, header->width, header->height, header->stride);
+	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+	{
+		cairo_surface_destroy(surface);
+		munmap(addr, length);
+		return NULL;
+	}
+
+	RasterMapping *mapping = g_new(RasterMapping, 1);
+	mapping->addr = addr;
+	mapping->length = length;
+	cairo_surface_set_user_data(surface, &mappingKey, mapping, (cairo_destroy_func_t)unmap_raster);
+	return surface;
+}
+
+static gboolean write_all(int fd, gconstpointer data, gsize length)
+{
+	const guchar *p = data;
+	while(length > 0)
+	{
+		gssize r = write(fd, p, length);
+		if(r < 0 && errno == EINTR)
+			continue;
+		if(r <= 0)
+			return FALSE;
+		p += r;
+		length -= r;
+	}
+	return TRUE;
+}
+
+/*
+ * Writes a raster file to a temporary name and renames it into place, so
+ * other processes only ever see complete files.
+ */
+static gboolean write_raster_file(const gchar *path, const gchar *key, cairo_surface_t *surface)
+{
+	cairo_format_t format = cairo_image_surface_get_format(surface);
+	if(format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_A8)
+		return FALSE;
+	cairo_surface_flush(surface);
+
+	gsize keyLength = strlen(key);
+	RasterHeader header = {0};
+	header.magic = RASTER_MAGIC;
+	header.format = format;
+	header.width = cairo_image_surface_get_width(surface);
+	header.height = cairo_image_surface_get_height(surface);
+	header.stride = cairo_image_surface_get_stride(surface);
+	header.keyLength = keyLength;
+	header.dataOffset = (sizeof(RasterHeader) + keyLength + RASTER_DATA_ALIGN - 1) / RASTER_DATA_ALIGN * RASTER_DATA_ALIGN;
+
+	static const guchar padding[RASTER_DATA_ALIGN] = {0};
+	gchar *tmp = g_strdup_printf("%s.XXXXXX", path);
+	int fd = g_mkstemp(tmp);
+	if(fd < 0)
+	{
+		g_free(tmp);
+		return FALSE;
+	}
+
+	gboolean r = write_all(fd, &header, sizeof(RasterHeader))
+		&& write_all(fd, key, keyLength)
+		&& write_all(fd, padding, header.dataOffset - sizeof(RasterHeader) - keyLength)
+		&& write_all(fd, cairo_image_surface_get_data(surface), (gsize)header.stride * header.height);
+	r = (close(fd) == 0) && r;
+	if(r)
+		r = (g_rename(tmp, path) == 0);
+	if(!r)
+		g_unlink(tmp);
+	g_free(tmp);
+	return r;
+}
+
+/*
+ * Raster files are named by the SHA1 of their key. The index stores the
+ * first 32 bits of it, with INDEX_EMPTY and INDEX_TOMBSTONE reserved.
+ */
+static gint checksum_hash(const gchar *checksum)
+{
+	gchar first[9];
+	g_strlcpy(first, checksum, sizeof(first));
+	gint hash = (gint)strtoul(first, NULL, 16);
+	if(hash == INDEX_EMPTY || hash == INDEX_TOMBSTONE)
+		hash = 2;
+	return hash;
+}
+
+static gchar * key_checksum(const gchar *key, gint *hash)
+{
+	gchar *checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+	*hash = checksum_hash(checksum);
+	return checksum;
+}
+
+typedef struct
+{
+	gchar *path;
+	gint64 size;
+	gint64 mtime;
+	gint hash;
+} CacheEntry;
+
+static gint cache_entry_compare_age(const CacheEntry *a, const CacheEntry *b)
+{
+	return (a->mtime > b->mtime) - (a->mtime < b->mtime);
+}
+
+/*
+ * Deletes the least recently used raster files of a cache directory until
+ * it is under 3/4 of @cap bytes and @maxFiles files, and deletes temporary
+ * files left behind by crashed writers. If @index is given, the slots of
+ * deleted files are turned into tombstones, as are slots whose file is
+ * already gone. Processes racing here may both unlink the same file,
+ * which is harmless, and processes that still have it mapped keep their
+ * mapping.
+ */
+static void trim_cache_dir(const gchar *dirPath, gint64 cap, guint maxFiles, SharedIndex *index)
+{
+	GDir *dir = g_dir_open(dirPath, 0, NULL);
+	if(!dir)
+		return;
+
+	GArray *entries = g_array_new(FALSE, FALSE, sizeof(CacheEntry));
+	GHashTable *present = index ? g_hash_table_new(g_direct_hash, g_direct_equal) : NULL;
+	gint64 total = 0;
+	gint64 now = time(NULL);
+	const gchar *name;
+	while((name = g_dir_read_name(dir)))
+	{
+		if(g_strcmp0(name, "index") == 0)
+			continue;
+		CacheEntry entry;
+		GStatBuf st;
+		entry.path = g_build_filename(dirPath, name, NULL);
+		if(g_stat(entry.path, &st) != 0)
+		{
+			g_free(entry.path);
+			continue;
+		}
+
+		// Raster files are a bare checksum; anything else is a write in
+		// progress, or abandoned
+		if(strchr(name, '.'))
+		{
+			if(st.st_mtime + TEMP_FILE_MAX_AGE < now)
+				g_unlink(entry.path);
+			g_free(entry.path);
+			continue;
+		}
+
+		entry.size = st.st_size;
+		entry.mtime = st.st_mtime;
+		entry.hash = checksum_hash(name);
+		total += entry.size;
+		g_array_append_val(entries, entry);
+		if(present)
+			g_hash_table_add(present, GINT_TO_POINTER(entry.hash));
+	}
+	g_dir_close(dir);
+
+	guint count = entries->len;
+	if(total > cap || count > maxFiles)
+	{
+		g_array_sort(entries, (GCompareFunc)cache_entry_compare_age);
+		for(guint i=0;i<entries->len && (total > cap/4*3 || count > maxFiles/4*3);++i)
+		{
+			CacheEntry *entry = &g_array_index(entries, CacheEntry, i);
+			if(g_unlink(entry->path) != 0)
+				continue;
+			total -= entry->size;
+			count--;
+			if(present)
+				g_hash_table_remove(present, GINT_TO_POINTER(entry->hash));
+		}
+	}
+
+	// Reclaim the slots of every file that no longer exists. A file
+	// published after the directory was read loses its slot too, which
+	// only costs a decode.
+	if(index)
+	{
+		for(guint i=0;i<INDEX_SLOTS;++i)
+		{
+			gint value = g_atomic_int_get(&index->slots[i]);
+			if(value != INDEX_EMPTY && value != INDEX_TOMBSTONE
+			&& !g_hash_table_contains(present, GINT_TO_POINTER(value)))
+				g_atomic_int_compare_and_exchange(&index->slots[i], value, INDEX_TOMBSTONE);
+		}
+		g_hash_table_unref(present);
+	}
+
+	for(guint i=0;i<entries->len;++i)
+		g_free(g_array_index(entries, CacheEntry, i).path);
+	g_array_unref(entries);
+}
+
+/*
+ * Trims a cache once a good fraction of its cap has been written since
+ * the last time, so the directory isn't rescanned on every store.
+ */
+static void maybe_trim_cache(const gchar *dir, gint64 cap, guint maxFiles, SharedIndex *index, gint *trimming, gint *bytesSinceTrim, gint bytes)
+{
+	g_atomic_int_add(bytesSinceTrim, bytes);
+	if(g_atomic_int_get(bytesSinceTrim) >= cap/4
+	&& g_atomic_int_compare_and_exchange(trimming, FALSE, TRUE))
+	{
+		g_atomic_int_set(bytesSinceTrim, 0);
+		trim_cache_dir(dir, cap, maxFiles, index);
+		g_atomic_int_set(trimming, FALSE);
+	}
+}
+
+static SharedCache * open_shared_cache(void)
+{
+	gchar *dir = g_build_filename(g_get_user_runtime_dir(), SHARED_DIR_NAME, NULL);
+	if(g_mkdir_with_parents(dir, 0700) != 0)
+	{
+		g_free(dir);
+		return NULL;
+	}
+
+	gchar *indexPath = g_build_filename(dir, "index", NULL);
+	int fd = g_open(indexPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	g_free(indexPath);
+	if(fd < 0)
+	{
+		g_free(dir);
+		return NULL;
+	}
+
+	// Growing an empty file zero-fills it, which is an empty index. If two
+	// processes race here they both truncate it to the same size.
+	struct stat st;
+	SharedIndex *index = MAP_FAILED;
+	if(fstat(fd, &st) == 0
+	&& (st.st_size >= (off_t)sizeof(SharedIndex) || ftruncate(fd, sizeof(SharedIndex)) == 0))
+		index = mmap(NULL, sizeof(SharedIndex), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(index == MAP_FAILED)
+	{
+		g_free(dir);
+		return NULL;
+	}
+
+	g_atomic_int_compare_and_exchange(&index->magic, 0, INDEX_MAGIC);
+	g_atomic_int_compare_and_exchange(&index->numSlots, 0, INDEX_SLOTS);
+	if(g_atomic_int_get(&index->magic) != INDEX_MAGIC
+	|| g_atomic_int_get(&index->numSlots) != INDEX_SLOTS)
+	{
+		g_warning("Ignoring incompatible shared icon cache in %s", dir);
+		munmap(index, sizeof(SharedIndex));
+		g_free(dir);
+		return NULL;
+	}
+
+	SharedCache *cache = g_new0(SharedCache, 1);
+	cache->dir = dir;
+	cache->index = index;
+
+	// Clean up after processes that crashed mid-write or went over the
+	// cap, and reclaim slots of files deleted since
+	trim_cache_dir(dir, SHARED_CACHE_CAP, INDEX_SLOTS/2, index);
+	return cache;
+}
+
+// Opened on first use, and kept open for the life of the process
+static SharedCache * get_shared_cache(void)
+{
+	static gsize init = 0;
+	static SharedCache *cache = NULL;
+	if(g_once_init_enter(&init))
+	{
+		cache = open_shared_cache();
+		g_once_init_leave(&init, 1);
+	}
+	return cache;
+}
+
+/*
+ * Returns the slot holding hash, or else the first free slot (tombstone
+ * or empty) it could go in, or NULL. The search stops at an empty slot.
+ */
+static gint * find_slot(SharedIndex *index, gint hash)
+{
+	gint *freeSlot = NULL;
+	for(guint i=0;i<INDEX_MAX_PROBES;++i)
+	{
+		gint *slot = &index->slots[((guint)hash + i) % INDEX_SLOTS];
+		gint value = g_atomic_int_get(slot);
+		if(value == hash)
+			return slot;
+		if(value == INDEX_TOMBSTONE && !freeSlot)
+			freeSlot = slot;
+		if(value == INDEX_EMPTY)
+			return freeSlot ? freeSlot : slot;
+	}
+	return freeSlot;
+}
+
+cairo_surface_t * cmk_icon_cache_shared_lookup(const gchar *key)
+{
+	SharedCache *cache = get_shared_cache();
+	if(!cache || !key)
+		return NULL;
+
+	gint hash;
+	gchar *checksum = key_checksum(key, &hash);
+	gint *slot = find_slot(cache->index, hash);
+	cairo_surface_t *surface = NULL;
+	if(slot && g_atomic_int_get(slot) == hash)
+	{
+		gchar *path = g_build_filename(cache->dir, checksum, NULL);
+		surface = map_raster_file(path, key, SHARED_TOUCH_INTERVAL);
+		// Trimmed by another process, which didn't get to the slot
+		if(!surface && !g_file_test(path, G_FILE_TEST_EXISTS))
+			g_atomic_int_compare_and_exchange(slot, hash, INDEX_TOMBSTONE);
+		g_free(path);
+	}
+	g_free(checksum);
+	return surface;
+}
+
+void cmk_icon_cache_shared_store(const gchar *key, cairo_surface_t *surface)
+{
+	SharedCache *cache = get_shared_cache();
+	if(!cache || !key || !surface)
+		return;
+
+	gint hash;
+	gchar *checksum = key_checksum(key, &hash);
+	gint *slot = find_slot(cache->index, hash);
+
+	// If the slot already has the hash, another process got here first.
+	// If the index is full around this hash, give up until a trim frees
+	// some slots; the icon will just be decoded by each process, as it
+	// would without the cache.
+	gint freeValue = slot ? g_atomic_int_get(slot) : INDEX_EMPTY;
+	gboolean written = FALSE;
+	if(slot && (freeValue == INDEX_EMPTY || freeValue == INDEX_TOMBSTONE))
+	{
+		gchar *path = g_build_filename(cache->dir, checksum, NULL);
+		if((written = write_raster_file(path, key, surface)))
+		{
+			// Publish only once the file is in place. Losing the race to
+			// another writer of a different hash means probing on.
+			while(slot && !g_atomic_int_compare_and_exchange(slot, freeValue, hash)
+			&& g_atomic_int_get(slot) != hash)
+			{
+				slot = find_slot(cache->index, hash);
+				freeValue = slot ? g_atomic_int_get(slot) : INDEX_EMPTY;
+			}
+		}
+		g_free(path);
+	}
+	g_free(checksum);
+
+	gint bytes = written ? cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface) : 0;
+	if(!slot)
+		bytes = SHARED_CACHE_CAP/4; // Full index; trim now
+	maybe_trim_cache(cache->dir, SHARED_CACHE_CAP, INDEX_SLOTS/2, cache->index,
+		&cache->trimming, &cache->bytesSinceTrim, bytes);
+}
+
+static DiskCache * open_disk_cache(void)
+{
+	if(g_strcmp0(g_getenv("CMK_ICON_DISK_CACHE"), "0") == 0)
+		return NULL;
+
+	gchar *dir = g_build_filename(g_get_user_cache_dir(), "cmk", DISK_DIR_NAME, NULL);
+	if(g_mkdir_with_parents(dir, 0700) != 0)
+	{
+		g_free(dir);
+		return NULL;
+	}
+
+	DiskCache *cache = g_new0(DiskCache, 1);
+	cache->dir = dir;
+	// Trim once soon after startup, in case a previous run went over
+	cache->bytesSinceTrim = DISK_CACHE_CAP;
+	return cache;
+}
+
+static DiskCache * get_disk_cache(void)
+{
+	static gsize init = 0;
+	static DiskCache *cache = NULL;
+	if(g_once_init_enter(&init))
+	{
+		cache = open_disk_cache();
+		g_once_init_leave(&init, 1);
+	}
+	return cache;
+}
+
+cairo_surface_t * cmk_icon_cache_disk_lookup(const gchar *key)
+{
+	DiskCache *cache = get_disk_cache();
+	if(!cache || !key)
+		return NULL;
+
+	gint hash;
+	gchar *checksum = key_checksum(key, &hash);
+	gchar *path = g_build_filename(cache->dir, checksum, NULL);
+	cairo_surface_t *surface = map_raster_file(path, key, DISK_TOUCH_INTERVAL);
+	g_free(path);
+	g_free(checksum);
+	return surface;
+}
+
+void cmk_icon_cache_disk_store(const gchar *key, cairo_surface_t *surface)
+{
+	DiskCache *cache = get_disk_cache();
+	if(!cache || !key || !surface)
+		return;
+
+	gint hash;
+	gchar *checksum = key_checksum(key, &hash);
+	gchar *path = g_build_filename(cache->dir, checksum, NULL);
+	gint bytes = 0;
+	if(write_raster_file(path, key, surface))
+		bytes = cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+	g_free(path);
+	g_free(checksum);
+	maybe_trim_cache(cache->dir, DISK_CACHE_CAP, G_MAXUINT, NULL,
+		&cache->trimming, &cache->bytesSinceTrim, bytes);
+}
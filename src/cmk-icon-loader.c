@@ -5,8 +5,14 @@
  */
 
 #include "cmk-icon-loader.h"
+#include "cmk-icon-raster-private.h"
+#include "cmk-icon-cache-private.h"
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <librsvg/rsvg.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
 
 typedef struct
 {
@@ -17,6 +23,8 @@ typedef struct
 	guint maxSize;
 	gboolean scalable; // Shorthand for "minSize == maxSize"
 	guint scale; // Not same as "scalable"; this is for icons on HiDPI screens using x2,x3,etc GUI scale
+	gboolean searched; // TRUE once the directory has been read into the theme's icons tree
+	gboolean loose; // Icons directly in a resource theme's path, with no size
 } IconThemeGroup;
 
 enum
@@ -34,6 +42,8 @@ struct _IconInfo
 	IconInfo *next; // Next version of this icon
 };
 
+typedef struct _FlatIndex FlatIndex;
+
 typedef struct
 {
 	gchar *name;
@@ -41,21 +51,79 @@ typedef struct
 	gchar **fallbacks; // NULL terminated
 	gsize numGroups;
 	IconThemeGroup *groups;
+	gsize numUnsearched; // Valid groups whose directory hasn't been read yet
 	
 	// Key: icon name (string)
+	// Only contains icons from groups which have been searched.
 	// Value: IconInfo * (a linked list)
 	GTree *icons;
+
+	// Key: ranking_key(size, scale)
+	// Value: GroupRanking *, built the first time that pair is looked up
+	GHashTable *rankings;
+
+	// Created the first time a lookup misses in this theme
+	FlatIndex *flat;
 } IconTheme;
 
+/*
+ * Icon names mapped straight to the first theme in a theme's inheritance
+ * chain which has the icon, as the XDG lookup order would find it, or to
+ * NULL if no theme in the chain has it. Names are added as lookups walk
+ * the chain, which only reads the groups they need: a theme is read
+ * entirely only when the icon turns out not to be in it, which the walk
+ * has to establish anyway. Once every theme in the chain has been read
+ * entirely, all their names are merged in and the index is complete, so
+ * a name it doesn't have is a miss. Entries never change once added.
+ */
+struct _FlatIndex
+{
+	GPtrArray *chain; // IconTheme *, root first and hicolor last. Not owned.
+	// Key: icon name (owned)
+	// Value: IconTheme * from chain, or NULL for a miss
+	GHashTable *names;
+	gboolean complete;
+};
+
+/*
+ * How well each of a theme's groups matches one requested (size, scale)
+ * pair. Themes only have a handful of groups and apps only use a handful
+ * of sizes, so these are kept for the life of the theme.
+ */
+typedef struct
+{
+	guint *ranks; // group_rank of each group, indexed like theme->groups
+	gsize *order; // Indices of valid groups, best rank first
+	gsize numOrdered;
+} GroupRanking;
+
 struct _CmkIconLoader
 {
 	GObject parent;
 	guint setScale;
 	gchar *setDefaultTheme;
+	gchar *settingsDefaultTheme; // Main thread only, for get_default_theme
 	GSettings *settings;
-	GTree *themes;
+	gboolean useSharedCache;
+
+	// Guards themes and everything in them, and setDefaultTheme. Lookups
+	// first try with only a reader lock, which is all they need once the
+	// themes, directories and rankings they touch have been loaded. The
+	// disk is never read while holding it.
+	GRWLock indexLock;
+	GTree *themes; // Value: IconTheme *, or NULL if the theme failed to load
+	GPtrArray *resourceThemes; // IconTheme *, searched before any theme
+
+	// Resolved icon path per content type, see content_type_key. Cleared
+	// whenever a theme change could resolve them differently; bumping the
+	// generation stops lookups already in flight from re-adding old paths.
+	GMutex contentTypeLock;
+	GHashTable *contentTypes; // Value: path, or NULL if nothing was found
+	guint contentTypeGeneration;
 };
 
+#define RESOURCE_SCHEME "resource://"
+
 enum
 {
 	PROP_SCALE = 1,
@@ -65,7 +133,16 @@ enum
 
 static GParamSpec *properties[PROP_LAST];
 
+enum
+{
+	SIGNAL_ICONS_CHANGED = 1,
+	SIGNAL_LAST
+};
+
+static guint signals[SIGNAL_LAST];
+
 static void cmk_icon_loader_dispose(GObject *self_);
+static void cmk_icon_loader_finalize(GObject *self_);
 static void cmk_icon_loader_set_property(GObject *self_, guint propertyId, const GValue *value, GParamSpec *pspec);
 static void cmk_icon_loader_get_property(GObject *self_, guint propertyId, GValue *value, GParamSpec *pspec);
 static void on_scale_changed(CmkIconLoader *self);
@@ -84,16 +161,22 @@ CmkIconLoader * cmk_icon_loader_new(void)
 CmkIconLoader * cmk_icon_loader_get_default(void)
 {
 	static CmkIconLoader *global = NULL;
+	G_LOCK_DEFINE_STATIC(global);
+	G_LOCK(global);
 	if(CMK_IS_ICON_LOADER(global))
-		return g_object_ref(global);
-	global = cmk_icon_loader_new();
-	return global;
+		g_object_ref(global);
+	else
+		global = cmk_icon_loader_new();
+	CmkIconLoader *loader = global;
+	G_UNLOCK(global);
+	return loader;
 }
 
 static void cmk_icon_loader_class_init(CmkIconLoaderClass *class)
 {
 	GObjectClass *base = G_OBJECT_CLASS(class);
 	base->dispose = cmk_icon_loader_dispose;
+	base->finalize = cmk_icon_loader_finalize;
 	base->set_property = cmk_icon_loader_set_property;
 	base->get_property = cmk_icon_loader_get_property;
 
@@ -101,13 +184,26 @@ static void cmk_icon_loader_class_init(CmkIconLoaderClass *class)
 	properties[PROP_DEFAULT_THEME] = g_param_spec_string("default-theme", "default-theme", "Global default icon theme", NULL, G_PARAM_READWRITE);
 
 	g_object_class_install_properties(base, PROP_LAST, properties);
+
+	signals[SIGNAL_ICONS_CHANGED] =
+		g_signal_new("icons-changed",
+		             G_TYPE_FROM_CLASS(class),
+		             G_SIGNAL_RUN_FIRST,
+		             0,
+		             NULL, NULL, NULL, G_TYPE_NONE, 0);
 }
 
 static void cmk_icon_loader_init(CmkIconLoader *self)
 {
 	self->setScale = 0;
+	self->useSharedCache = (g_strcmp0(g_getenv("CMK_SHARED_ICON_CACHE"), "1") == 0);
+	g_rw_lock_init(&self->indexLock);
 	self->themes = g_tree_new_full((GCompareDataFunc)g_strcmp0, NULL, g_free, (GDestroyNotify)free_icon_theme);
+	self->resourceThemes = g_ptr_array_new_with_free_func((GDestroyNotify)free_icon_theme);
+	g_mutex_init(&self->contentTypeLock);
+	self->contentTypes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 	self->settings = g_settings_new("org.gnome.desktop.interface");
+	self->settingsDefaultTheme = g_settings_get_string(self->settings, "icon-theme");
 	g_signal_connect_swapped(self->settings, "changed::scaling-factor", G_CALLBACK(on_scale_changed), self);
 	g_signal_connect_swapped(self->settings, "changed::icon-theme", G_CALLBACK(on_default_theme_changed), self);
 }
@@ -116,11 +212,21 @@ static void cmk_icon_loader_dispose(GObject *self_)
 {
 	CmkIconLoader *self = CMK_ICON_LOADER(self_);
 	g_clear_pointer(&self->themes, g_tree_unref);
+	g_clear_pointer(&self->resourceThemes, g_ptr_array_unref);
+	g_clear_pointer(&self->contentTypes, g_hash_table_unref);
 	g_clear_pointer(&self->setDefaultTheme, g_free);
+	g_clear_pointer(&self->settingsDefaultTheme, g_free);
 	g_clear_object(&self->settings);
 	G_OBJECT_CLASS(cmk_icon_loader_parent_class)->dispose(self_);
 }
 
+static void cmk_icon_loader_finalize(GObject *self_)
+{
+	g_rw_lock_clear(&CMK_ICON_LOADER(self_)->indexLock);
+	g_mutex_clear(&CMK_ICON_LOADER(self_)->contentTypeLock);
+	G_OBJECT_CLASS(cmk_icon_loader_parent_class)->finalize(self_);
+}
+
 static void cmk_icon_loader_set_property(GObject *self_, guint propertyId, const GValue *value, GParamSpec *pspec)
 {
 	g_return_if_fail(CMK_IS_ICON_LOADER(self_));
@@ -151,7 +257,7 @@ static void cmk_icon_loader_get_property(GObject *self_, guint propertyId, GValu
 		g_value_set_int(value, cmk_icon_loader_get_scale(self));
 		break;
 	case PROP_DEFAULT_THEME:
-		g_value_set_string(value, cmk_icon_loader_get_default_theme(self));
+		g_value_take_string(value, cmk_icon_loader_dup_default_theme(self));
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(self, propertyId, pspec);
@@ -165,10 +271,25 @@ static void on_scale_changed(CmkIconLoader *self)
 		g_object_notify_by_pspec(G_OBJECT(self), properties[PROP_SCALE]);
 }
 
+static void clear_content_types(CmkIconLoader *self)
+{
+	g_mutex_lock(&self->contentTypeLock);
+	if(self->contentTypes)
+		g_hash_table_remove_all(self->contentTypes);
+	self->contentTypeGeneration++;
+	g_mutex_unlock(&self->contentTypeLock);
+}
+
 static void on_default_theme_changed(CmkIconLoader *self)
 {
+	g_free(self->settingsDefaultTheme);
+	self->settingsDefaultTheme = g_settings_get_string(self->settings, "icon-theme");
 	if(!self->setDefaultTheme)
+	{
+		clear_content_types(self);
+		g_signal_emit(self, signals[SIGNAL_ICONS_CHANGED], 0);
 		g_object_notify_by_pspec(G_OBJECT(self), properties[PROP_DEFAULT_THEME]);
+	}
 }
 
 void cmk_icon_loader_set_scale(CmkIconLoader *self, guint scale)
@@ -195,8 +316,12 @@ void cmk_icon_loader_set_default_theme(CmkIconLoader *self, const gchar *theme)
 	g_return_if_fail(CMK_ICON_LOADER(self));
 	if(g_strcmp0(self->setDefaultTheme, theme) != 0)
 	{
+		g_rw_lock_writer_lock(&self->indexLock);
 		g_free(self->setDefaultTheme);
 		self->setDefaultTheme = g_strdup(theme);
+		g_rw_lock_writer_unlock(&self->indexLock);
+		clear_content_types(self);
+		g_signal_emit(self, signals[SIGNAL_ICONS_CHANGED], 0);
 		g_object_notify_by_pspec(G_OBJECT(self), properties[PROP_DEFAULT_THEME]);
 	}
 }
@@ -206,11 +331,36 @@ const gchar * cmk_icon_loader_get_default_theme(CmkIconLoader *self)
 	g_return_val_if_fail(CMK_ICON_LOADER(self), NULL);
 	if(self->setDefaultTheme)
 		return self->setDefaultTheme;
-	return g_settings_get_string(self->settings, "icon-theme");
+	return self->settingsDefaultTheme;
+}
+
+gchar * cmk_icon_loader_dup_default_theme(CmkIconLoader *self)
+{
+	g_return_val_if_fail(CMK_ICON_LOADER(self), NULL);
+	g_rw_lock_reader_lock(&self->indexLock);
+	gchar *theme = g_strdup(self->setDefaultTheme);
+	g_rw_lock_reader_unlock(&self->indexLock);
+	if(!theme)
+		theme = g_settings_get_string(self->settings, "icon-theme");
+	return theme;
+}
+
+void cmk_icon_loader_set_use_shared_cache(CmkIconLoader *self, gboolean useSharedCache)
+{
+	g_return_if_fail(CMK_IS_ICON_LOADER(self));
+	self->useSharedCache = useSharedCache;
+}
+
+gboolean cmk_icon_loader_get_use_shared_cache(CmkIconLoader *self)
+{
+	g_return_val_if_fail(CMK_IS_ICON_LOADER(self), FALSE);
+	return self->useSharedCache;
 }
 
 static void free_icon_theme(IconTheme *theme)
 {
+	if(!theme)
+		return;
 	g_free(theme->name);
 	g_free(theme->where);
 	g_strfreev(theme->fallbacks);
@@ -222,9 +372,24 @@ static void free_icon_theme(IconTheme *theme)
 	g_free(theme->groups);
 	if(theme->icons)
 		g_tree_unref(theme->icons);
+	if(theme->rankings)
+		g_hash_table_unref(theme->rankings);
+	if(theme->flat)
+	{
+		g_ptr_array_unref(theme->flat->chain);
+		g_hash_table_unref(theme->flat->names);
+		g_free(theme->flat);
+	}
 	g_free(theme);
 }
 
+static void free_group_ranking(GroupRanking *ranking)
+{
+	g_free(ranking->ranks);
+	g_free(ranking->order);
+	g_free(ranking);
+}
+
 static void free_icon_info_list(IconInfo *base)
 {
 	for(IconInfo *it=base;it!=NULL;)
@@ -271,13 +436,54 @@ static guint fext_to_flag(const gchar *ext)
 	return extFlag;
 }
 
-static void search_theme_group(IconTheme *theme, IconThemeGroup *group)
+/*
+ * A group directory's contents, read without touching the theme (and
+ * without holding indexLock) so that groups can be read on scanPool's
+ * threads and merged afterwards.
+ */
+typedef struct _ScanBatch ScanBatch;
+typedef struct
 {
-	if(!group->where || !theme->where)
-		return;
-	gchar *path = g_strdup_printf("%s/%s/", theme->where, group->where);
-	GDir *dir = g_dir_open(path, 0, NULL);
-	g_free(path);
+	IconTheme *theme;
+	IconThemeGroup *group;
+	ScanBatch *batch;
+	gchar *path; // NULL if the group has no directory to read
+	GPtrArray *names; // Icon names (gchar *), owned
+	GArray *extFlags; // guchar FEXT_* flag for each name
+} GroupScan;
+
+struct _ScanBatch
+{
+	GMutex mutex;
+	GCond cond;
+	guint remaining;
+};
+
+static GThreadPool *scanPool = NULL;
+
+static GroupScan * new_group_scan(IconTheme *theme, IconThemeGroup *group)
+{
+	GroupScan *scan = g_new0(GroupScan, 1);
+	scan->theme = theme;
+	scan->group = group;
+	if(group->where && theme->where)
+		scan->path = g_strdup_printf("%s/%s/", theme->where, group->where);
+	scan->names = g_ptr_array_new_with_free_func(g_free);
+	scan->extFlags = g_array_new(FALSE, FALSE, sizeof(guchar));
+	return scan;
+}
+
+static void free_group_scan(GroupScan *scan)
+{
+	g_ptr_array_unref(scan->names);
+	g_array_unref(scan->extFlags);
+	g_free(scan->path);
+	g_free(scan);
+}
+
+static void read_group_dir(GroupScan *scan)
+{
+	GDir *dir = scan->path ? g_dir_open(scan->path, 0, NULL) : NULL;
 	if(!dir)
 		return;
 
@@ -285,20 +491,96 @@ static void search_theme_group(IconTheme *theme, IconThemeGroup *group)
 	while((entry = g_dir_read_name(dir)))
 	{
 		const gchar *extStart = g_strrstr(entry, ".");
-		gsize basenameLength = extStart - entry;
-		gchar *name = g_strndup(entry, basenameLength);
-		guint extFlag = fext_to_flag(extStart+1);
+		if(!extStart)
+			continue;
+		guchar extFlag = fext_to_flag(extStart+1);
 		if(extFlag == 0)
 			continue;
+		g_ptr_array_add(scan->names, g_strndup(entry, extStart - entry));
+		g_array_append_val(scan->extFlags, extFlag);
+	}
+	
+	g_dir_close(dir);
+}
+
+/*
+ * Merges a read directory into its theme's icons tree. Another lookup may
+ * have read and merged the same group in the meantime, in which case the
+ * scan is dropped. Must hold indexLock for writing.
+ */
+static void merge_group_scan(GroupScan *scan)
+{
+	IconTheme *theme = scan->theme;
+	IconThemeGroup *group = scan->group;
+	if(group->searched)
+		return;
+	group->searched = TRUE;
+	theme->numUnsearched--;
+
+	for(guint i=0;i<scan->names->len;++i)
+	{
+		gchar *name = g_ptr_array_index(scan->names, i);
+		guchar extFlag = g_array_index(scan->extFlags, guchar, i);
 
 		IconInfo *infoList = NULL;
 		if(g_tree_lookup_extended(theme->icons, name, NULL, (gpointer *)&infoList) && infoList)
 			icon_info_list_add(infoList, group, extFlag);
 		else
+		{
 			g_tree_insert(theme->icons, name, icon_info_list_add(NULL, group, extFlag));
+			g_ptr_array_index(scan->names, i) = NULL; // Stolen by the tree
+		}
 	}
-	
-	g_dir_close(dir);
+}
+
+static void scan_pool_func(GroupScan *scan, UNUSED gpointer userdata)
+{
+	read_group_dir(scan);
+
+	ScanBatch *batch = scan->batch;
+	g_mutex_lock(&batch->mutex);
+	if(--batch->remaining == 0)
+		g_cond_signal(&batch->cond);
+	g_mutex_unlock(&batch->mutex);
+}
+
+/*
+ * Reads the directories of several groups at once, each into its own
+ * GroupScan on scanPool. Returns once every read has finished. Must not
+ * hold indexLock. Lookups pass the best block of equally ranked groups
+ * on their own, since a hit there ends the search, and everything after
+ * it together once that block has missed.
+ */
+static void read_group_scans(GPtrArray *scans)
+{
+	if(scans->len <= 1)
+	{
+		for(guint i=0;i<scans->len;++i)
+			read_group_dir(g_ptr_array_index(scans, i));
+		return;
+	}
+
+	if(g_once_init_enter(&scanPool))
+		g_once_init_leave(&scanPool, g_thread_pool_new((GFunc)scan_pool_func, NULL, g_get_num_processors(), FALSE, NULL));
+
+	ScanBatch batch;
+	g_mutex_init(&batch.mutex);
+	g_cond_init(&batch.cond);
+	batch.remaining = scans->len;
+
+	for(guint i=0;i<scans->len;++i)
+	{
+		GroupScan *scan = g_ptr_array_index(scans, i);
+		scan->batch = &batch;
+		g_thread_pool_push(scanPool, scan, NULL);
+	}
+
+	g_mutex_lock(&batch.mutex);
+	while(batch.remaining > 0)
+		g_cond_wait(&batch.cond, &batch.mutex);
+	g_mutex_unlock(&batch.mutex);
+	g_mutex_clear(&batch.mutex);
+	g_cond_clear(&batch.cond);
 }
 
 static gboolean load_theme_group(GKeyFile *index, IconThemeGroup *group)
@@ -362,33 +644,61 @@ static IconTheme * load_theme_from(const gchar *themeName, const gchar *dir)
 
 	theme->fallbacks = g_key_file_get_string_list(index, "Icon Theme", "Inherits", NULL, NULL);
 	theme->icons = g_tree_new_full((GCompareDataFunc)g_strcmp0, NULL, g_free, (GDestroyNotify)free_icon_info_list);
-
-	// TODO: "ScaledDirectories" folder
-	gchar **directories = g_key_file_get_string_list(index, "Icon Theme", "Directories", &theme->numGroups, NULL);
-	if(!directories)
+	theme->rankings = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)free_group_ranking);
+
+	// ScaledDirectories lists the HiDPI (Scale > 1) groups, kept separate
+	// so that loaders without scale support don't pick them up. Both lists
+	// are treated the same from here on; each group's Scale key says what
+	// it is for. Some themes list their scaled groups in both keys, which
+	// would read those directories twice.
+	gsize numUnscaled = 0, numScaled = 0;
+	gchar **directories = g_key_file_get_string_list(index, "Icon Theme", "Directories", &numUnscaled, NULL);
+	gchar **scaledDirectories = g_key_file_get_string_list(index, "Icon Theme", "ScaledDirectories", &numScaled, NULL);
+	if(!directories && !scaledDirectories)
 	{
 		free_icon_theme(theme);
-		g_object_unref(index);
+		g_key_file_unref(index);
 		return NULL;
 	}
 	
+	theme->numGroups = numUnscaled + numScaled;
 	if(theme->numGroups)	
 		theme->groups = g_new0(IconThemeGroup, theme->numGroups);
 
-	gboolean noGroups = TRUE;
-	for(gsize i=0;i<theme->numGroups;++i)
+	// Only index.theme is parsed here. Group directories are read
+	// lazily by find_icon_info, the first time a lookup could use them.
+	// Checked before the loop, which frees the names of invalid groups
+	GHashTable *unscaled = g_hash_table_new(g_str_hash, g_str_equal);
+	for(gsize i=0;i<numUnscaled;++i)
+		g_hash_table_add(unscaled, directories[i]);
+	gboolean *duplicate = g_new0(gboolean, numScaled + 1);
+	for(gsize i=0;i<numScaled;++i)
+		duplicate[i] = g_hash_table_contains(unscaled, scaledDirectories[i]);
+	g_hash_table_unref(unscaled);
+
+	gsize numGroups = 0;
+	for(gsize i=0;i<numUnscaled+numScaled;++i)
 	{
-		theme->groups[i].where = directories[i];
-		if(load_theme_group(index, &theme->groups[i]))
+		gchar *where = (i < numUnscaled) ? directories[i] : scaledDirectories[i - numUnscaled];
+		if(i >= numUnscaled && duplicate[i - numUnscaled])
 		{
-			search_theme_group(theme, &theme->groups[i]);
-			noGroups = FALSE;
+			g_free(where);
+			continue;
 		}
+		IconThemeGroup *group = &theme->groups[numGroups++];
+		group->where = where;
+		if(load_theme_group(index, group))
+			theme->numUnsearched++;
 		else
-			g_clear_pointer(&(theme->groups[i].where), g_free);
+			g_clear_pointer(&group->where, g_free);
 	}
+	theme->numGroups = numGroups;
+	g_free(duplicate);
+	gboolean noGroups = (theme->numUnsearched == 0);
 
-	g_free(directories); // The strings have been stolen by the Groups
+	// The strings have been stolen by the Groups, or freed as duplicates
+	g_free(directories);
+	g_free(scaledDirectories);
 	g_key_file_unref(index);
 
 	if(noGroups)
@@ -417,16 +727,47 @@ static IconTheme * load_theme(const gchar *name)
 	return NULL;
 }
 
-static IconTheme * get_theme(CmkIconLoader *self, const gchar *name)
+/*
+ * The lookup functions below never touch the disk, so that indexLock is
+ * never held across I/O. With only the reader lock held (state->writer is
+ * FALSE), anything missing from the index makes them set incomplete and
+ * give up. With the writer lock, missing rankings and flat index entries,
+ * which only take memory, are built on the spot. A theme that hasn't been
+ * loaded or group directories that haven't been read are recorded in the
+ * state instead, and the lookup gives up. The caller then drops the lock,
+ * does that I/O, merges it in under the writer lock and tries again.
+ */
+typedef struct
+{
+	gboolean writer;
+	gboolean incomplete;
+	gchar *loadTheme; // Name of a theme to load
+	GPtrArray *scans; // GroupScan *, directories to read
+} LookupState;
+
+static IconTheme * get_theme(CmkIconLoader *self, const gchar *name, LookupState *state)
 {
 	// TODO: Check for changes to directory mtime or index.theme
-	IconTheme *theme = g_tree_lookup(self->themes, name);
-	if(theme)
+	IconTheme *theme = NULL;
+	if(g_tree_lookup_extended(self->themes, name, NULL, (gpointer *)&theme))
 		return theme;
-	theme = load_theme(name);
-	if(theme)
+	if(!state->loadTheme)
+		state->loadTheme = g_strdup(name);
+	state->incomplete = TRUE;
+	return NULL;
+}
+
+/*
+ * Adds a theme loaded while no lock was held. Themes that don't exist are
+ * remembered too (as %NULL), so that looking for them again doesn't need
+ * the writer lock. Must hold indexLock for writing.
+ */
+static void add_loaded_theme(CmkIconLoader *self, const gchar *name, IconTheme *theme)
+{
+	if(g_tree_lookup_extended(self->themes, name, NULL, NULL))
+		free_icon_theme(theme); // Another lookup loaded it first
+	else
 		g_tree_insert(self->themes, g_strdup(name), theme);
-	return theme;
 }
 
 inline static guint uint_diff(guint a, guint b)
@@ -434,49 +775,169 @@ inline static guint uint_diff(guint a, guint b)
 	return (a>b) ? a-b : b-a;
 }
 
-static IconInfo * best_icon_from_info_list(IconInfo *infoList, guint size, guint scale)
+/*
+ * Ranks how well a group matches the requested size and scale. Lower is
+ * better. First choice is a perfect match (scale and size match), then a
+ * 'pretty good' one (scale matches, and size is within bounds). This is
+ * differentiable from just finding the closest abs size as below,
+ * because (for example) a 64x64@1x icon may not equal a 32x32@2x icon.
+ * The scale should try to match first before finding the best size.
+ * Anything else is probably going to look equally bad, so it's ranked by
+ * how close its abs scalable size is to the abs pixel size requested.
+ */
+static guint group_rank(IconThemeGroup *group, guint size, guint scale)
 {
-	// First look for perfect size icon (scale and size match)
-	for(IconInfo *it=infoList;it!=NULL;it=it->next)
-		if(it->group->scale == scale && it->group->size == size)
-			return it;
-	
-	// Look for 'pretty good' sized icon (scale matches, and size is within bounds)
-	// This is differentiable from just finding the closest abs size as below,
-	// because (for example) a 64x64@1x icon may not equal a 32x32@2x icon. The
-	// scale should try to match first before finding the best size.
-	for(IconInfo *it=infoList;it!=NULL;it=it->next)
-		if(it->group->scale == scale && size >= it->group->minSize && size <= it->group->maxSize)
-			return it;
-	
-	// Anything else is probably going to look equally bad, so just find the
-	// icon with an abs scalable size closest to the abs pixel size requested.
+	if(group->scale == scale && group->size == size)
+		return 0;
+	if(group->scale == scale && size >= group->minSize && size <= group->maxSize)
+		return 1;
 	guint absSize = size * scale;
-	guint closestDist = G_MAXUINT;
+	guint dMin = uint_diff(group->minSize*group->scale, absSize);
+	guint dMax = uint_diff(group->maxSize*group->scale, absSize);
+	return 2 + MIN(dMin, dMax);
+}
+
+static gint group_index_compare(const gsize *a, const gsize *b, const guint *ranks)
+{
+	return (ranks[*a] > ranks[*b]) - (ranks[*a] < ranks[*b]);
+}
+
+static gpointer ranking_key(guint size, guint scale)
+{
+	return GUINT_TO_POINTER((size << 8) | MIN(scale, 0xFF));
+}
+
+static GroupRanking * get_group_ranking(IconTheme *theme, guint size, guint scale, LookupState *state)
+{
+	gpointer key = ranking_key(size, scale);
+	GroupRanking *ranking = g_hash_table_lookup(theme->rankings, key);
+	if(ranking)
+		return ranking;
+	if(!state->writer)
+	{
+		state->incomplete = TRUE;
+		return NULL;
+	}
+
+	ranking = g_new(GroupRanking, 1);
+	ranking->ranks = g_new(guint, theme->numGroups);
+	ranking->order = g_new(gsize, theme->numGroups);
+	ranking->numOrdered = 0;
+	for(gsize i=0;i<theme->numGroups;++i)
+	{
+		if(!theme->groups[i].where)
+		{
+			ranking->ranks[i] = G_MAXUINT;
+			continue;
+		}
+		// Loose icons have no size to rank by, so they come after every
+		// sized group
+		if(theme->groups[i].loose)
+			ranking->ranks[i] = G_MAXUINT - 1;
+		else
+			ranking->ranks[i] = group_rank(&theme->groups[i], size, scale);
+		ranking->order[ranking->numOrdered++] = i;
+	}
+
+	// Stable, so equally ranked groups stay in index.theme order
+	g_qsort_with_data(ranking->order, ranking->numOrdered, sizeof(gsize), (GCompareDataFunc)group_index_compare, ranking->ranks);
+
+	g_hash_table_insert(theme->rankings, key, ranking);
+	return ranking;
+}
+
+/*
+ * Picks the best version of an icon: the first one in the list from the
+ * best ranked group.
+ */
+static IconInfo * best_icon_from_info_list(IconTheme *theme, IconInfo *infoList, const GroupRanking *ranking)
+{
 	IconInfo *icon = NULL;
+	guint bestRank = G_MAXUINT;
 	for(IconInfo *it=infoList;it!=NULL;it=it->next)
 	{
-		guint dMin = uint_diff(it->group->minSize*it->group->scale, absSize);
-		guint dMax = uint_diff(it->group->maxSize*it->group->scale, absSize);
-		guint d = MIN(dMin, dMax);
-		if(d == 0)
-			return it;
-		if(d < closestDist)
+		guint rank = ranking->ranks[it->group - theme->groups];
+		if(rank < bestRank)
 		{
-			closestDist = d;
 			icon = it;
+			bestRank = rank;
+			if(rank == 0)
+				break;
 		}
 	}
 	return icon;
 }
 
-static gchar * find_icon_in_theme(IconTheme *theme, const gchar *name, guint size, guint scale)
+/*
+ * Finds the best version of an icon in the theme, reading the theme's
+ * group directories as needed. Groups are read best match first, and the
+ * search stops as soon as the icon has been found in a group that no
+ * unread group could beat. A miss still has to read every group, but
+ * only once per theme. Once the best groups have been read and missed,
+ * every group left is read at once, rather than one block of equally
+ * ranked groups at a time.
+ */
+static IconInfo * find_icon_info(IconTheme *theme, const gchar *name, guint size, guint scale, LookupState *state)
 {
-	IconInfo *infoList = g_tree_lookup(theme->icons, name);
-	if(!infoList)
+	GroupRanking *ranking = get_group_ranking(theme, size, scale, state);
+	if(!ranking)
 		return NULL;
-	
-	IconInfo *icon = best_icon_from_info_list(infoList, size, scale);
+	if(theme->numUnsearched == 0)
+		return best_icon_from_info_list(theme, g_tree_lookup(theme->icons, name), ranking);
+
+	IconInfo *icon = NULL;
+	gboolean missed = FALSE;
+	for(gsize start=0, end=0;start<ranking->numOrdered;start=end)
+	{
+		// Equally ranked groups must all be read before checking, since
+		// any of them could hold the icon. They are read in parallel.
+		guint rank = ranking->ranks[ranking->order[start]];
+		gboolean unread = FALSE;
+		for(end=start;end<ranking->numOrdered && ranking->ranks[ranking->order[end]] == rank;++end)
+		{
+			IconThemeGroup *group = &theme->groups[ranking->order[end]];
+			if(group->searched)
+				continue;
+			if(!state->scans)
+				state->scans = g_ptr_array_new_with_free_func((GDestroyNotify)free_group_scan);
+			g_ptr_array_add(state->scans, new_group_scan(theme, group));
+			unread = TRUE;
+		}
+		if(unread)
+		{
+			// A name missing from the best groups is most likely missing
+			// from the theme, which needs every group read anyway
+			for(;missed && end<ranking->numOrdered;++end)
+			{
+				IconThemeGroup *group = &theme->groups[ranking->order[end]];
+				if(!group->searched)
+					g_ptr_array_add(state->scans, new_group_scan(theme, group));
+			}
+			state->incomplete = TRUE;
+			break;
+		}
+
+		// The icon may already be known from a worse group read during an
+		// earlier lookup, so only accept it once nothing unread is better.
+		icon = best_icon_from_info_list(theme, g_tree_lookup(theme->icons, name), ranking);
+		if(icon && ranking->ranks[icon->group - theme->groups] <= rank)
+			break;
+		icon = NULL;
+		missed = TRUE;
+	}
+	return icon;
+}
+
+static gchar * build_icon_path(IconTheme *theme, IconInfo *icon, const gchar *name, const gchar *ext)
+{
+	gchar *file = g_strconcat(name, ".", ext, NULL);
+	gchar *path = g_build_filename(theme->where, icon->group->where, file, NULL);
+	g_free(file);
+	return path;
+}
+
+static gchar * icon_path(IconTheme *theme, IconInfo *icon, const gchar *name, guint size, guint scale)
+{
 	if(!icon)
 		return NULL;
 
@@ -484,11 +945,13 @@ static gchar * find_icon_in_theme(IconTheme *theme, const gchar *name, guint siz
 	 * We've found an icon, but there may be multiple filetypes for the same
 	 * icon. Prefer a non-scalable type (ex. png) if the icon doesn't need
 	 * to be scaled, since it'll load faster. Otherwise, prefer .svg.
+	 * What matters is the pixel size, so a 48x48@2 request is served
+	 * as-is by a 48x48@2 or 96x96 group.
 	 */
 	
-	#define ICRETURN(ext) g_strdup_printf("%s/%s/%s." ext, theme->where, icon->group->where, name)
+	#define ICRETURN(ext) build_icon_path(theme, icon, name, ext)
 
-	gboolean needsScaling = (icon->group->size != size);
+	gboolean needsScaling = (icon->group->size * icon->group->scale != size * scale);
 	if(needsScaling)
 	{
 		if((icon->extFlags & FEXT_SVG) == FEXT_SVG)
@@ -507,122 +970,451 @@ static gchar * find_icon_in_theme(IconTheme *theme, const gchar *name, guint siz
 	return NULL;
 }
 
+static gchar * find_icon_in_theme(IconTheme *theme, const gchar *name, guint size, guint scale, LookupState *state)
+{
+	return icon_path(theme, find_icon_info(theme, name, size, scale, state), name, size, scale);
+}
+
+static void add_to_chain(CmkIconLoader *self, GPtrArray *chain, IconTheme *theme, LookupState *state)
+{
+	if(!theme)
+		return;
+	for(guint i=0;i<chain->len;++i)
+		if(g_ptr_array_index(chain, i) == theme)
+			return;
+
+	g_ptr_array_add(chain, theme);
+	if(!theme->fallbacks)
+		return;
+	for(guint i=0;theme->fallbacks[i]!=NULL && !state->incomplete;++i)
+		if(g_strcmp0(theme->fallbacks[i], "hicolor") != 0)
+			add_to_chain(self, chain, get_theme(self, theme->fallbacks[i], state), state);
+}
+
+static gboolean add_flat_name(gchar *name, UNUSED IconInfo *info, gpointer *data)
+{
+	FlatIndex *flat = data[0];
+	if(!g_hash_table_contains(flat->names, name))
+		g_hash_table_insert(flat->names, g_strdup(name), data[1]);
+	return FALSE;
+}
+
+/*
+ * Creates the theme's (empty) FlatIndex. Inherited themes are searched
+ * depth first, in the order they are listed, and hicolor always comes
+ * last. Returns %NULL if a theme in the chain still has to be loaded.
+ * Must hold indexLock for writing.
+ */
+static FlatIndex * get_flat_index(CmkIconLoader *self, IconTheme *root, LookupState *state)
+{
+	if(root->flat)
+		return root->flat;
+	GPtrArray *chain = g_ptr_array_new();
+	add_to_chain(self, chain, root, state);
+	if(!state->incomplete)
+		add_to_chain(self, chain, get_theme(self, "hicolor", state), state);
+	if(state->incomplete)
+	{
+		g_ptr_array_unref(chain);
+		return NULL;
+	}
+
+	FlatIndex *flat = g_new0(FlatIndex, 1);
+	flat->chain = chain;
+	flat->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	root->flat = flat;
+	return flat;
+}
+
+/*
+ * Merges every name of the chain into the index, once lookups have read
+ * every theme in it entirely. Must hold indexLock for writing.
+ */
+static void complete_flat_index(FlatIndex *flat)
+{
+	for(guint i=0;i<flat->chain->len;++i)
+		if(((IconTheme *)g_ptr_array_index(flat->chain, i))->numUnsearched > 0)
+			return;
+
+	for(guint i=0;i<flat->chain->len;++i)
+	{
+		IconTheme *theme = g_ptr_array_index(flat->chain, i);
+		gpointer data[2] = {flat, theme};
+		g_tree_foreach(theme->icons, (GTraverseFunc)add_flat_name, data);
+	}
+	flat->complete = TRUE;
+}
+
+/*
+ * Finds an icon in a theme or anything it inherits from. Names the flat
+ * index already knows go straight to the theme that has them. Otherwise
+ * the chain is walked in order, and the result recorded unless the icon
+ * was in the root theme itself.
+ */
+static gchar * find_icon_in_chain(CmkIconLoader *self, IconTheme *root, const gchar *name, guint size, guint scale, LookupState *state)
+{
+	FlatIndex *flat = root->flat;
+	IconTheme *theme = NULL;
+	if(flat && g_hash_table_lookup_extended(flat->names, name, NULL, (gpointer *)&theme))
+		return theme ? find_icon_in_theme(theme, name, size, scale, state) : NULL;
+
+	// Icons in the theme itself don't need the index
+	gchar *path = find_icon_in_theme(root, name, size, scale, state);
+	if(path || state->incomplete)
+		return path;
+	if(flat && flat->complete)
+		return NULL;
+	if(!state->writer)
+	{
+		state->incomplete = TRUE;
+		return NULL;
+	}
+
+	// Every theme before the one the icon is found in has had all its
+	// groups read by now, so it lacks the icon at any size
+	if(!(flat = get_flat_index(self, root, state)))
+		return NULL;
+	for(guint i=1;i<flat->chain->len;++i)
+	{
+		theme = g_ptr_array_index(flat->chain, i);
+		if((path = find_icon_in_theme(theme, name, size, scale, state)))
+		{
+			g_hash_table_insert(flat->names, g_strdup(name), theme);
+			return path;
+		}
+		if(state->incomplete)
+			return NULL;
+	}
+	g_hash_table_insert(flat->names, g_strdup(name), NULL);
+	complete_flat_index(flat);
+	return NULL;
+}
+
 gchar * cmk_icon_loader_lookup(CmkIconLoader *self, const gchar *name, guint size)
 {
 	return cmk_icon_loader_lookup_full(self, name, FALSE, NULL, TRUE, size, cmk_icon_loader_get_scale(self));
 }
 
+/*
+ * Fills in a group from a resource directory name, which is laid out like
+ * hicolor: "48x48", "48x48@2" or "scalable", followed by a context.
+ */
+static gboolean load_resource_group(IconThemeGroup *group, const gchar *sizeDir)
+{
+	guint size, height, scale = 1;
+	if(g_str_has_prefix(sizeDir, "scalable"))
+	{
+		sscanf(sizeDir, "scalable@%u", &scale);
+		group->size = 128;
+		group->minSize = 1;
+		group->maxSize = 512;
+	}
+	else if(sscanf(sizeDir, "%ux%u@%u", &size, &height, &scale) >= 2 && size > 0)
+	{
+		group->size = size;
+		group->minSize = size > 2 ? size - 2 : 1; // Threshold of 2, like hicolor
+		group->maxSize = size + 2;
+	}
+	else
+		return FALSE;
+	group->scale = MAX(scale, 1);
+	group->scalable = (group->maxSize == group->minSize);
+	return TRUE;
+}
+
+static void add_resource_icons(IconTheme *theme, IconThemeGroup *group)
+{
+	gchar *dir = g_strdup_printf("%s/%s", theme->where + strlen(RESOURCE_SCHEME), group->where);
+	gchar **files = g_resources_enumerate_children(dir, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+	g_free(dir);
+	if(!files)
+		return;
+
+	for(guint i=0;files[i]!=NULL;++i)
+	{
+		const gchar *extStart = g_strrstr(files[i], ".");
+		guchar extFlag = extStart ? fext_to_flag(extStart+1) : 0;
+		if(extFlag == 0)
+			continue;
+
+		gchar *name = g_strndup(files[i], extStart - files[i]);
+		IconInfo *infoList = NULL;
+		if(g_tree_lookup_extended(theme->icons, name, NULL, (gpointer *)&infoList) && infoList)
+		{
+			icon_info_list_add(infoList, group, extFlag);
+			g_free(name);
+		}
+		else
+			g_tree_insert(theme->icons, name, icon_info_list_add(NULL, group, extFlag));
+	}
+	g_strfreev(files);
+}
+
+/*
+ * Builds a theme out of icons compiled into the app's GResources. The
+ * whole tree is read up front, which is cheap since resources are already
+ * in memory, and the theme counts as fully searched from the start.
+ */
+static IconTheme * load_resource_theme(const gchar *path)
+{
+	gchar *base = g_strdup(path);
+	while(g_str_has_suffix(base, "/") && strlen(base) > 1)
+		base[strlen(base)-1] = '\0';
+
+	gchar **sizeDirs = g_resources_enumerate_children(base, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+	if(!sizeDirs)
+	{
+		g_free(base);
+		return NULL;
+	}
+
+	// Groups are collected first, since IconInfos point into the array
+	GArray *groups = g_array_new(FALSE, TRUE, sizeof(IconThemeGroup));
+	for(guint i=0;sizeDirs[i]!=NULL;++i)
+	{
+		if(!g_str_has_suffix(sizeDirs[i], "/"))
+			continue;
+		IconThemeGroup group = {0};
+		if(!load_resource_group(&group, sizeDirs[i]))
+			continue;
+
+		gchar *sizePath = g_strdup_printf("%s/%s", base, sizeDirs[i]);
+		gchar **contexts = g_resources_enumerate_children(sizePath, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+		g_free(sizePath);
+		for(guint j=0;contexts && contexts[j]!=NULL;++j)
+		{
+			if(!g_str_has_suffix(contexts[j], "/"))
+				continue;
+			group.context = g_strndup(contexts[j], strlen(contexts[j])-1);
+			group.where = g_strdup_printf("%s%s", sizeDirs[i], group.context);
+			group.searched = TRUE;
+			g_array_append_val(groups, group);
+		}
+		g_strfreev(contexts);
+	}
+
+	// Icons directly in the path are the worst match for every size
+	IconThemeGroup loose = {0};
+	loose.where = g_strdup("");
+	loose.searched = TRUE;
+	loose.loose = TRUE;
+	g_array_append_val(groups, loose);
+	g_strfreev(sizeDirs);
+
+	IconTheme *theme = g_new0(IconTheme, 1);
+	theme->name = g_strdup(base);
+	theme->where = g_strconcat(RESOURCE_SCHEME, base, NULL);
+	theme->numGroups = groups->len;
+	theme->groups = (IconThemeGroup *)g_array_free(groups, FALSE);
+	theme->icons = g_tree_new_full((GCompareDataFunc)g_strcmp0, NULL, g_free, (GDestroyNotify)free_icon_info_list);
+	theme->rankings = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)free_group_ranking);
+	for(gsize i=0;i<theme->numGroups;++i)
+		add_resource_icons(theme, &theme->groups[i]);
+
+	g_free(base);
+	return theme;
+}
+
+void cmk_icon_loader_add_resource_path(CmkIconLoader *self, const gchar *path)
+{
+	g_return_if_fail(CMK_IS_ICON_LOADER(self));
+	g_return_if_fail(path != NULL);
+
+	IconTheme *theme = load_resource_theme(path);
+	if(!theme)
+		return;
+
+	g_rw_lock_writer_lock(&self->indexLock);
+	g_ptr_array_add(self->resourceThemes, theme);
+	g_rw_lock_writer_unlock(&self->indexLock);
+	clear_content_types(self);
+	g_signal_emit(self, signals[SIGNAL_ICONS_CHANGED], 0);
+}
+
+static gchar * lookup_locked(CmkIconLoader *self, const gchar *name, const gchar *themeName, gboolean useFallbackTheme, guint size, guint scale, LookupState *state)
+{
+	// The app's own icons take priority over any theme
+	for(guint i=0;i<self->resourceThemes->len;++i)
+	{
+		gchar *path = find_icon_in_theme(g_ptr_array_index(self->resourceThemes, i), name, size, scale, state);
+		if(path || state->incomplete)
+			return path;
+	}
+
+	IconTheme *theme = get_theme(self, themeName, state);
+	if(!theme && useFallbackTheme && !state->incomplete)
+		theme = get_theme(self, "hicolor", state);
+	if(!theme)
+		return NULL; // Search pixmaps
+
+	if(!useFallbackTheme)
+		return find_icon_in_theme(theme, name, size, scale, state); // TOOD: Search pixmaps
+
+	// Once a name has been looked up, hits and misses anywhere in the
+	// inheritance chain start with a single hash table lookup
+	return find_icon_in_chain(self, theme, name, size, scale, state);
+	// TODO: Search /usr/share/pixmaps
+}
+
 // TODO fallback names
 gchar * cmk_icon_loader_lookup_full(CmkIconLoader *self, const gchar *name, UNUSED gboolean useFallbackNames, const gchar *themeName, gboolean useFallbackTheme, guint size, guint scale)
 {
 	g_return_val_if_fail(CMK_IS_ICON_LOADER(self), NULL);
-	
+
+	gchar *defaultTheme = NULL;
 	if(!themeName)
-		themeName = cmk_icon_loader_get_default_theme(self);
+		themeName = defaultTheme = cmk_icon_loader_dup_default_theme(self);
 	//if(!themeName)
 	// 	just search pixmaps
 
-	gboolean triedHicolor = FALSE;
-	IconTheme *theme = get_theme(self, themeName);
-	if(!theme)
+	// Usually everything needed is loaded already, and concurrent lookups
+	// can share the index
+	LookupState state = {FALSE, FALSE, NULL, NULL};
+	g_rw_lock_reader_lock(&self->indexLock);
+	gchar *path = lookup_locked(self, name, themeName, useFallbackTheme, size, scale, &state);
+	g_rw_lock_reader_unlock(&self->indexLock);
+
+	// Otherwise, retry while holding it exclusively. Whatever the lookup
+	// needed from disk is read first with no lock held, so readers only
+	// ever wait for the merge, never for the I/O. Each round reads at
+	// most one theme or one block of groups, and the lookup resumes
+	// where it left off.
+	state.writer = TRUE;
+	while(state.incomplete)
 	{
-		if(!useFallbackTheme)
-			return NULL; // Search pixmaps
-		theme = get_theme(self, "hicolor");
-		if(!theme)
-			return NULL; // Search pixmaps
-		triedHicolor = TRUE;
+		IconTheme *loaded = state.loadTheme ? load_theme(state.loadTheme) : NULL;
+		if(state.scans)
+			read_group_scans(state.scans);
+
+		g_rw_lock_writer_lock(&self->indexLock);
+		if(state.loadTheme)
+			add_loaded_theme(self, state.loadTheme, loaded);
+		for(guint i=0;state.scans && i<state.scans->len;++i)
+			merge_group_scan(g_ptr_array_index(state.scans, i));
+		g_clear_pointer(&state.loadTheme, g_free);
+		g_clear_pointer(&state.scans, g_ptr_array_unref);
+		state.incomplete = FALSE;
+		path = lookup_locked(self, name, themeName, useFallbackTheme, size, scale, &state);
+		g_rw_lock_writer_unlock(&self->indexLock);
 	}
 
-	gchar *path = find_icon_in_theme(theme, name, size, scale);
-	if(path)
-		return path;
+	g_free(defaultTheme);
+	return path;
+}
 
-	if(!useFallbackTheme)
-		return NULL; // TOOD: Search pixmaps
+static gchar * content_type_key(const gchar *contentType, gboolean symbolic, const gchar *themeName, guint size, guint scale)
+{
+	return g_strdup_printf("%u@%u:%s:%s:%s", size, scale, symbolic ? "s" : "", themeName ? themeName : "", contentType);
+}
+
+/*
+ * Tries each name of the content type's themed icon in order. GIO
+ * already ends the list with generic fallbacks such as text-x-generic.
+ */
+static gchar * resolve_content_type(CmkIconLoader *self, const gchar *contentType, gboolean symbolic, const gchar *themeName, guint size, guint scale)
+{
+	GIcon *icon = symbolic ? g_content_type_get_symbolic_icon(contentType) : g_content_type_get_icon(contentType);
+	if(!icon)
+		return NULL;
 
-	if(theme->fallbacks)
+	gchar *path = NULL;
+	if(G_IS_THEMED_ICON(icon))
 	{
-		for(guint i=0;theme->fallbacks[i]!=NULL;++i)
-		{
-			if(g_strcmp0(theme->fallbacks[i], "hicolor") == 0)
-			{
-				if(triedHicolor)
-					continue;
-				triedHicolor = TRUE;
-			}
-			IconTheme *t = get_theme(self, theme->fallbacks[i]);
-			if(t)
-				path = find_icon_in_theme(t, name, size, scale);
-			if(path)
-				return path;
-		}
+		const gchar * const *names = g_themed_icon_get_names(G_THEMED_ICON(icon));
+		for(guint i=0;names && names[i] && !path;++i)
+			path = cmk_icon_loader_lookup_full(self, names[i], TRUE, themeName, TRUE, size, scale);
 	}
-	
-	if(!triedHicolor)
+	g_object_unref(icon);
+	return path;
+}
+
+gchar * cmk_icon_loader_lookup_content_type(CmkIconLoader *self, const gchar *contentType, gboolean symbolic, const gchar *themeName, guint size, guint scale)
+{
+	g_return_val_if_fail(CMK_IS_ICON_LOADER(self), NULL);
+	g_return_val_if_fail(contentType != NULL, NULL);
+
+	gchar *key = content_type_key(contentType, symbolic, themeName, size, scale);
+	gchar *path = NULL;
+	g_mutex_lock(&self->contentTypeLock);
+	gboolean known = g_hash_table_lookup_extended(self->contentTypes, key, NULL, (gpointer *)&path);
+	path = g_strdup(path);
+	guint generation = self->contentTypeGeneration;
+	g_mutex_unlock(&self->contentTypeLock);
+	if(known)
 	{
-		theme = get_theme(self, "hicolor");
-		path = find_icon_in_theme(theme, name, size, scale);
-		if(path)
-			return path;
+		g_free(key);
+		return path;
 	}
 
-	// TODO: Search /usr/share/pixmaps
+	path = resolve_content_type(self, contentType, symbolic, themeName, size, scale);
 
-	// TODO: Fallback names
-	return NULL;
+	g_mutex_lock(&self->contentTypeLock);
+	if(generation == self->contentTypeGeneration)
+		g_hash_table_insert(self->contentTypes, key, g_strdup(path));
+	else
+		g_free(key);
+	g_mutex_unlock(&self->contentTypeLock);
+	return path;
 }
 
+// Shared by all loaders, and guarded by G_LOCK(loadCache)
 static GHashTable *loadCache = NULL;
+G_LOCK_DEFINE_STATIC(loadCache);
 
-static cairo_surface_t * get_cached_surface(const gchar *path, guint size)
+static gchar * cache_key(const gchar *path, guint size, guint scale, cairo_format_t format)
 {
-	if(!loadCache)
-		return NULL;
 	/*
 	 * Need to include size in cache name, because SVGs have
-	 * the same file path but can be loaded at any size.
+	 * the same file path but can be loaded at any size. The
+	 * scale is kept apart from the size, so that an icon's @2x
+	 * raster is never confused with the 1x raster of a size
+	 * twice as big. Masks of an icon are cached separately
+	 * from the full color one.
 	 */
-	gchar *s = g_strdup_printf("%i:%s", size, path);
-	cairo_surface_t *surface = g_hash_table_lookup(loadCache, s);
+	if(format == CAIRO_FORMAT_A8)
+		return g_strdup_printf("%u@%u:a8:%s", size, scale, path);
+	return g_strdup_printf("%u@%u:%s", size, scale, path);
+}
+
+static cairo_surface_t * get_cached_surface(const gchar *path, guint size, guint scale, cairo_format_t format)
+{
+	gchar *s = cache_key(path, size, scale, format);
+	cairo_surface_t *surface = NULL;
+	G_LOCK(loadCache);
+	if(loadCache)
+		surface = g_hash_table_lookup(loadCache, s);
+	if(surface)
+		cairo_surface_reference(surface);
+	G_UNLOCK(loadCache);
 	g_free(s);
-	if(!surface)
-		return NULL;
-	return cairo_surface_reference(surface);
+	return surface;
 }
 
-static void cache_surface(const gchar *path, guint size, cairo_surface_t *surface)
+static void cache_surface(const gchar *path, guint size, guint scale, cairo_surface_t *surface)
 {
+	gchar *s = cache_key(path, size, scale, cairo_image_surface_get_format(surface));
+	G_LOCK(loadCache);
 	if(!loadCache)
 	{
 		loadCache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)cairo_surface_destroy);
 	}
-
-	gchar *s = g_strdup_printf("%i:%s", size, path);
 	g_hash_table_insert(loadCache, s, cairo_surface_reference(surface));
+	G_UNLOCK(loadCache);
 }
 
-static cairo_surface_t * load_svg(const gchar *path, guint size, gboolean cache)
+static cairo_surface_t * decode_svg(RsvgHandle *handle, guint size)
 {
-	cairo_surface_t *cached = get_cached_surface(path, size);
-	if(cached) return cached;
-
-	RsvgHandle *handle = rsvg_handle_new_from_file(path, NULL);
 	if(!handle)
 		return NULL;
 
 	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
 	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
-	{
-		g_object_unref(handle);
 		return NULL;
-	}
 
 	cairo_t *cr = cairo_create(surface);
 	if(cairo_status(cr) != CAIRO_STATUS_SUCCESS)
 	{
 		cairo_surface_destroy(surface);
-		g_object_unref(handle);
 		return NULL;
 	}
 
@@ -632,57 +1424,530 @@ static cairo_surface_t * load_svg(const gchar *path, guint size, gboolean cache)
 	cairo_scale(cr, factor, factor);
 	gboolean r = rsvg_handle_render_cairo(handle, cr);
 	cairo_destroy(cr);
-	g_object_unref(handle);
 	if(!r)
 		g_clear_pointer(&surface, cairo_surface_destroy);
-	if(cache)
-		cache_surface(path, size, surface);
 	return surface;
 }
 
+/*
+ * The same scalable icon is often needed at several sizes (a list, a
+ * toolbar, a dialog), so parsed SVGs are kept around for a while and
+ * extra sizes only pay for rasterizing. Documents are keyed by path and
+ * revalidated against the file's mtime and size on every use. Only the
+ * SVG_DOCUMENT_CACHE_SIZE most recently used are kept.
+ *
+ * An RsvgHandle can't be rendered from two threads at once, so each
+ * document has its own lock held while rendering. When the prefetch
+ * workers want the same SVG at several sizes at once, the workers that
+ * find the lock taken parse a handle of their own instead of waiting, as
+ * parsing again costs less than rendering one after another.
+ */
+#define SVG_DOCUMENT_CACHE_SIZE 32
+
+typedef struct
+{
+	gint refcount;
+	gchar *path;
+	gint64 mtime;
+	gint64 fileSize;
+	RsvgHandle *handle;
+	GMutex renderLock;
+} SvgDocument;
+
+// Guarded by G_LOCK(svgDocuments). The queue holds the documents most
+// recently used first, and owns a reference to each.
+static GHashTable *svgDocuments = NULL;
+static GQueue svgDocumentQueue = G_QUEUE_INIT;
+G_LOCK_DEFINE_STATIC(svgDocuments);
+
+static void svg_document_unref(SvgDocument *doc)
+{
+	if(!g_atomic_int_dec_and_test(&doc->refcount))
+		return;
+	g_free(doc->path);
+	g_object_unref(doc->handle);
+	g_mutex_clear(&doc->renderLock);
+	g_free(doc);
+}
+
+static void uncache_svg_document(SvgDocument *doc)
+{
+	g_hash_table_remove(svgDocuments, doc->path);
+	g_queue_remove(&svgDocumentQueue, doc);
+	svg_document_unref(doc);
+}
 
-static cairo_surface_t * load_png(const gchar *path, guint size, gboolean cache)
+static SvgDocument * get_svg_document(const gchar *path)
 {
-	cairo_surface_t *cached = get_cached_surface(path, size);
-	if(cached) return cached;
-	
-	// TODO: Scale surface to size
-	// TODO: Cairo uses libpng to load the png files. It is extremely slow,
-	// over 11ms for a 192x192 pixel image. It's almost entirely from libpng;
-	// creating a cairo image surface and copying the data over is relatively
-	// fast. I tried a few different libpng image loaders for speed tests,
-	// and they were all the same speed. (https://mathematica.stackexchange.com/questions/104688/fast-loading-of-png-files is good)
-	// Is there any way to speed this up?
-	
-	cairo_surface_t *surface = cairo_image_surface_create_from_png(path);
-	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+	GStatBuf st;
+	if(g_stat(path, &st) != 0)
+		return NULL;
+
+	G_LOCK(svgDocuments);
+	if(!svgDocuments)
+		svgDocuments = g_hash_table_new(g_str_hash, g_str_equal);
+	SvgDocument *doc = g_hash_table_lookup(svgDocuments, path);
+	if(doc && doc->mtime == st.st_mtime && doc->fileSize == st.st_size)
 	{
-		cairo_surface_destroy(surface);
+		g_queue_remove(&svgDocumentQueue, doc);
+		g_queue_push_head(&svgDocumentQueue, doc);
+		g_atomic_int_inc(&doc->refcount);
+		G_UNLOCK(svgDocuments);
+		return doc;
+	}
+	if(doc)
+		uncache_svg_document(doc);
+	G_UNLOCK(svgDocuments);
+
+	// Parse without the lock, so other threads' lookups aren't held up.
+	// If two threads parse the same file at once, the last one wins.
+	RsvgHandle *handle = rsvg_handle_new_from_file(path, NULL);
+	if(!handle)
+		return NULL;
+
+	doc = g_new0(SvgDocument, 1);
+	doc->refcount = 2; // Caller and cache
+	doc->path = g_strdup(path);
+	doc->mtime = st.st_mtime;
+	doc->fileSize = st.st_size;
+	doc->handle = handle;
+	g_mutex_init(&doc->renderLock);
+
+	G_LOCK(svgDocuments);
+	SvgDocument *old = g_hash_table_lookup(svgDocuments, path);
+	if(old)
+		uncache_svg_document(old);
+	g_hash_table_insert(svgDocuments, doc->path, doc);
+	g_queue_push_head(&svgDocumentQueue, doc);
+	while(g_queue_get_length(&svgDocumentQueue) > SVG_DOCUMENT_CACHE_SIZE)
+		uncache_svg_document(g_queue_peek_tail(&svgDocumentQueue));
+	G_UNLOCK(svgDocuments);
+	return doc;
+}
+
+static cairo_surface_t * decode_svg_file(const gchar *path, guint size)
+{
+	SvgDocument *doc = get_svg_document(path);
+	if(!doc)
 		return NULL;
+
+	cairo_surface_t *surface = NULL;
+	if(g_mutex_trylock(&doc->renderLock))
+	{
+		surface = decode_svg(doc->handle, size);
+		g_mutex_unlock(&doc->renderLock);
 	}
-	
-	if(cache)
-		cache_surface(path, size, surface);
+	else
+	{
+		RsvgHandle *handle = rsvg_handle_new_from_file(path, NULL);
+		surface = decode_svg(handle, size);
+		if(handle)
+			g_object_unref(handle);
+	}
+	svg_document_unref(doc);
 	return surface;
 }
 
-cairo_surface_t * cmk_icon_loader_load(UNUSED CmkIconLoader *self, const gchar *path, guint size, guint scale, gboolean cache)
+/*
+ * Shrinks a surface bigger than size x size to fit it exactly, so that it
+ * is cached at the size it will be drawn at instead of being rescaled by
+ * cairo on every draw. Smaller surfaces are returned as-is.
+ */
+static cairo_surface_t * fit_surface_to_size(cairo_surface_t *surface, guint size)
 {
-	if(!path)
+	guint width = cairo_image_surface_get_width(surface);
+	guint height = cairo_image_surface_get_height(surface);
+	if(size == 0 || MAX(width, height) <= size)
+		return surface;
+
+	gdouble factor = (gdouble)size / MAX(width, height);
+	width = MAX(round(width * factor), 1);
+	height = MAX(round(height * factor), 1);
+	cairo_surface_t *scaled = cmk_raster_downscale(surface, width, height);
+	if(!scaled)
+		return surface;
+	cairo_surface_destroy(surface);
+	return scaled;
+}
+
+static cairo_surface_t * decode_png(cairo_surface_t *surface, guint size)
+{
+	if(!surface)
 		return NULL;
+	return fit_surface_to_size(surface, size);
+}
 
-	size *= scale;
+/*
+ * Decodes an icon compiled into a GResource. The data is read straight
+ * from the resource section of the mapped binary, without copying.
+ */
+static cairo_surface_t * decode_resource_icon(const gchar *path, guint size)
+{
+	GBytes *bytes = g_resources_lookup_data(path, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+	if(!bytes)
+		return NULL;
 
+	gsize length;
+	const guchar *data = g_bytes_get_data(bytes, &length);
 	cairo_surface_t *surface = NULL;
 	if(g_str_has_suffix(path, ".svg"))
-		surface = load_svg(path, size, cache);
+	{
+		RsvgHandle *handle = rsvg_handle_new_from_data(data, length, NULL);
+		surface = decode_svg(handle, size);
+		if(handle)
+			g_object_unref(handle);
+	}
+	else if(g_str_has_suffix(path, ".png"))
+		surface = decode_png(cmk_raster_decode_png_data(data, length), size);
+	g_bytes_unref(bytes);
+	return surface;
+}
+
+/*
+ * Decodes an icon file at a pixel size (already multiplied by the scale).
+ * Safe to call from any thread.
+ */
+static cairo_surface_t * decode_icon(const gchar *path, guint size)
+{
+	if(g_str_has_prefix(path, RESOURCE_SCHEME))
+		return decode_resource_icon(path + strlen(RESOURCE_SCHEME), size);
+	else if(g_str_has_suffix(path, ".svg"))
+		return decode_svg_file(path, size);
 	else if(g_str_has_suffix(path, ".png"))
-		surface = load_png(path, size, cache);
+	{
+		// cairo_image_surface_create_from_png took over 11ms for a 192x192
+		// pixel image. cmk_raster_decode_png has libpng write directly into
+		// the surface's buffer and premultiplies it in place with SIMD.
+		return decode_png(cmk_raster_decode_png(path), size);
+	}
 	
 	// TODO: Support other image types
+	return NULL;
+}
+
+/*
+ * Decodes an icon into the given format. For CAIRO_FORMAT_A8 only the
+ * alpha channel is kept, and the full color surface is thrown away.
+ */
+static cairo_surface_t * decode_icon_as(const gchar *path, guint size, cairo_format_t format)
+{
+	cairo_surface_t *surface = decode_icon(path, size);
+	if(!surface || format != CAIRO_FORMAT_A8)
+		return surface;
+	cairo_surface_t *mask = cmk_raster_extract_alpha(surface);
+	cairo_surface_destroy(surface);
+	return mask;
+}
+
+/*
+ * Like decode_icon, but goes through the out-of-process caches: the
+ * cross-process shared cache if it's enabled, so that only the first
+ * process to need an icon decodes it, and the on-disk cache for SVGs,
+ * so that they're only rasterized once per size across runs.
+ */
+static cairo_surface_t * load_icon_uncached(CmkIconLoader *self, const gchar *path, guint size, cairo_format_t format)
+{
+	// Resources are already in memory, and can't be keyed by mtime
+	if(g_str_has_prefix(path, RESOURCE_SCHEME))
+		return decode_icon_as(path, size, format);
+
+	gboolean useDiskCache = g_str_has_suffix(path, ".svg");
+	if(!self->useSharedCache && !useDiskCache)
+		return decode_icon_as(path, size, format);
+
+	gchar *key = cmk_icon_cache_make_key(path, size, format);
+	cairo_surface_t *surface = NULL;
+	if(self->useSharedCache)
+		surface = cmk_icon_cache_shared_lookup(key);
+
+	if(!surface && useDiskCache)
+	{
+		surface = cmk_icon_cache_disk_lookup(key);
+		if(surface && self->useSharedCache)
+			cmk_icon_cache_shared_store(key, surface);
+	}
+
+	if(!surface)
+	{
+		surface = decode_icon_as(path, size, format);
+		if(surface && useDiskCache)
+			cmk_icon_cache_disk_store(key, surface);
+		if(surface && self->useSharedCache)
+			cmk_icon_cache_shared_store(key, surface);
+	}
+	g_free(key);
+	return surface;
+}
+
+cairo_surface_t * cmk_icon_loader_load(CmkIconLoader *self, const gchar *path, guint size, guint scale, gboolean cache)
+{
+	if(!path)
+		return NULL;
+
+	cairo_surface_t *surface = get_cached_surface(path, size, scale, CAIRO_FORMAT_ARGB32);
+	if(surface)
+		return surface;
+
+	surface = load_icon_uncached(self, path, size * scale, CAIRO_FORMAT_ARGB32);
+	if(surface && cache)
+		cache_surface(path, size, scale, surface);
+	return surface;
+}
+
+cairo_surface_t * cmk_icon_loader_load_mask(CmkIconLoader *self, const gchar *path, guint size, guint scale, gboolean cache)
+{
+	if(!path)
+		return NULL;
+
+	cairo_surface_t *surface = get_cached_surface(path, size, scale, CAIRO_FORMAT_A8);
+	if(surface)
+		return surface;
+
+	// If the full color icon happens to be loaded already, its alpha is
+	// the same as a fresh decode's.
+	cairo_surface_t *argb = get_cached_surface(path, size, scale, CAIRO_FORMAT_ARGB32);
+	if(argb)
+	{
+		surface = cmk_raster_extract_alpha(argb);
+		cairo_surface_destroy(argb);
+	}
+	else
+		surface = load_icon_uncached(self, path, size * scale, CAIRO_FORMAT_A8);
+
+	if(surface && cache)
+		cache_surface(path, size, scale, surface);
 	return surface;
 }
 
+typedef struct _DecodeBatch DecodeBatch;
+typedef struct
+{
+	DecodeBatch *batch;
+	gchar *path;
+	guint size;
+	guint scale;
+	cairo_surface_t *surface;
+} PrefetchItem;
+
+struct _DecodeBatch
+{
+	CmkIconLoader *loader;
+	GMutex mutex;
+	GCond cond;
+	guint remaining;
+};
+
+static GThreadPool *decodePool = NULL;
+
+static void free_prefetch_item(PrefetchItem *item)
+{
+	g_free(item->path);
+	if(item->surface)
+		cairo_surface_destroy(item->surface);
+	g_free(item);
+}
+
+static void decode_pool_func(PrefetchItem *item, UNUSED gpointer userdata)
+{
+	DecodeBatch *batch = item->batch;
+	item->surface = load_icon_uncached(batch->loader, item->path, item->size * item->scale, CAIRO_FORMAT_ARGB32);
+
+	g_mutex_lock(&batch->mutex);
+	if(--batch->remaining == 0)
+		g_cond_signal(&batch->cond);
+	g_mutex_unlock(&batch->mutex);
+}
+
+/*
+ * Decodes every item of a batch on decodePool and waits for all of them.
+ * SVG rasterization is by far the slowest part of loading icons, and every
+ * decode uses its own RsvgHandle and surface, so a batch of icons (for
+ * example a launcher grid) scales with the number of cores. The surfaces
+ * are left in the items for the caller to merge into the cache.
+ */
+static void decode_items(CmkIconLoader *self, GPtrArray *items)
+{
+	if(items->len == 1)
+	{
+		PrefetchItem *item = g_ptr_array_index(items, 0);
+		item->surface = load_icon_uncached(self, item->path, item->size * item->scale, CAIRO_FORMAT_ARGB32);
+		return;
+	}
+
+	if(g_once_init_enter(&decodePool))
+		g_once_init_leave(&decodePool, g_thread_pool_new((GFunc)decode_pool_func, NULL, g_get_num_processors(), FALSE, NULL));
+
+	DecodeBatch batch;
+	batch.loader = self;
+	g_mutex_init(&batch.mutex);
+	g_cond_init(&batch.cond);
+	batch.remaining = items->len;
+
+	for(guint i=0;i<items->len;++i)
+	{
+		PrefetchItem *item = g_ptr_array_index(items, i);
+		item->batch = &batch;
+		g_thread_pool_push(decodePool, item, NULL);
+	}
+
+	g_mutex_lock(&batch.mutex);
+	while(batch.remaining > 0)
+		g_cond_wait(&batch.cond, &batch.mutex);
+	g_mutex_unlock(&batch.mutex);
+	g_mutex_clear(&batch.mutex);
+	g_cond_clear(&batch.cond);
+}
+
+cairo_surface_t ** cmk_icon_loader_load_batch(CmkIconLoader *self, const gchar * const *paths, guint size, guint scale, gboolean cache)
+{
+	g_return_val_if_fail(CMK_IS_ICON_LOADER(self), NULL);
+	if(!paths)
+		return NULL;
+
+	guint numPaths = g_strv_length((gchar **)paths);
+	cairo_surface_t **surfaces = g_new0(cairo_surface_t *, numPaths + 1);
+
+	// Cache hits are filled in directly. Misses are decoded together, but
+	// an icon repeated in the batch is only decoded once.
+	GPtrArray *items = g_ptr_array_new_with_free_func((GDestroyNotify)free_prefetch_item);
+	GHashTable *pending = g_hash_table_new(g_str_hash, g_str_equal);
+	gint *itemIndex = g_new(gint, numPaths);
+	for(guint i=0;i<numPaths;++i)
+	{
+		itemIndex[i] = -1;
+		if((surfaces[i] = get_cached_surface(paths[i], size, scale, CAIRO_FORMAT_ARGB32)))
+			continue;
+
+		gpointer index;
+		if(g_hash_table_lookup_extended(pending, paths[i], NULL, &index))
+		{
+			itemIndex[i] = GPOINTER_TO_INT(index);
+			continue;
+		}
+
+		PrefetchItem *item = g_new0(PrefetchItem, 1);
+		item->path = g_strdup(paths[i]);
+		item->size = size;
+		item->scale = scale;
+		itemIndex[i] = items->len;
+		g_hash_table_insert(pending, item->path, GINT_TO_POINTER(items->len));
+		g_ptr_array_add(items, item);
+	}
+	g_hash_table_unref(pending);
+
+	if(items->len > 0)
+		decode_items(self, items);
+
+	for(guint i=0;i<numPaths;++i)
+	{
+		if(itemIndex[i] < 0)
+			continue;
+		PrefetchItem *item = g_ptr_array_index(items, itemIndex[i]);
+		if(item->surface)
+			surfaces[i] = cairo_surface_reference(item->surface);
+	}
+
+	if(cache)
+	{
+		for(guint i=0;i<items->len;++i)
+		{
+			PrefetchItem *item = g_ptr_array_index(items, i);
+			if(item->surface)
+				cache_surface(item->path, item->size, item->scale, item->surface);
+		}
+	}
+
+	g_free(itemIndex);
+	g_ptr_array_unref(items);
+	return surfaces;
+}
+
+typedef struct
+{
+	gchar **names;
+	guint *sizes; // 0-terminated
+	guint scale;
+} PrefetchRequest;
+
+static void free_prefetch_request(PrefetchRequest *request)
+{
+	g_strfreev(request->names);
+	g_free(request->sizes);
+	g_free(request);
+}
+
+static void prefetch_thread(GTask *task, CmkIconLoader *self, PrefetchRequest *request, UNUSED GCancellable *cancellable)
+{
+	GPtrArray *items = g_ptr_array_new_with_free_func((GDestroyNotify)free_prefetch_item);
+	GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for(guint i=0;request->names[i]!=NULL;++i)
+	{
+		for(guint j=0;request->sizes[j]!=0;++j)
+		{
+			gchar *path = cmk_icon_loader_lookup_full(self, request->names[i], TRUE, NULL, TRUE, request->sizes[j], request->scale);
+			if(!path)
+				continue;
+			
+			guint size = request->sizes[j];
+			gchar *key = cache_key(path, size, request->scale, CAIRO_FORMAT_ARGB32);
+			cairo_surface_t *cached = get_cached_surface(path, size, request->scale, CAIRO_FORMAT_ARGB32);
+			if(cached || g_hash_table_contains(seen, key))
+			{
+				if(cached)
+					cairo_surface_destroy(cached);
+				g_free(key);
+				g_free(path);
+				continue;
+			}
+			g_hash_table_add(seen, key);
+
+			PrefetchItem *item = g_new0(PrefetchItem, 1);
+			item->path = path;
+			item->size = size;
+			item->scale = request->scale;
+			g_ptr_array_add(items, item);
+		}
+	}
+	g_hash_table_unref(seen);
+
+	if(items->len > 0)
+		decode_items(self, items);
+
+	for(guint i=0;i<items->len;++i)
+	{
+		PrefetchItem *item = g_ptr_array_index(items, i);
+		if(item->surface)
+			cache_surface(item->path, item->size, item->scale, item->surface);
+	}
+	g_ptr_array_unref(items);
+	g_task_return_boolean(task, TRUE);
+}
+
+void cmk_icon_loader_prefetch(CmkIconLoader *self, const gchar * const *names, const guint *sizes, guint scale)
+{
+	g_return_if_fail(CMK_IS_ICON_LOADER(self));
+	if(!names || !sizes || !names[0] || !sizes[0])
+		return;
+	if(scale == 0)
+		scale = cmk_icon_loader_get_scale(self);
+
+	// Lookups and decoding all happen in the background
+	PrefetchRequest *request = g_new0(PrefetchRequest, 1);
+	request->names = g_strdupv((gchar **)names);
+	guint numSizes = 0;
+	while(sizes[numSizes] != 0)
+		++numSizes;
+	request->sizes = g_new(guint, numSizes + 1);
+	for(guint i=0;i<=numSizes;++i)
+		request->sizes[i] = sizes[i];
+	request->scale = scale;
+
+	GTask *task = g_task_new(self, NULL, NULL, NULL);
+	g_task_set_task_data(task, request, (GDestroyNotify)free_prefetch_request);
+	g_task_run_in_thread(task, (GTaskThreadFunc)prefetch_thread);
+	g_object_unref(task);
+}
+
 cairo_surface_t * cmk_icon_loader_get(CmkIconLoader *self, const gchar *name, guint size)
 {
 	guint scale = cmk_icon_loader_get_scale(self);
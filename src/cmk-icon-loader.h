@@ -21,6 +21,16 @@ G_DECLARE_FINAL_TYPE(CmkIconLoader, cmk_icon_loader, CMK, ICON_LOADER, GObject);
  * @SHORT_DESCRIPTION: Utilities for loading icon themes
  *
  * CmkIconLoader is a class to load icons from system icons themes.
+ *
+ * Lookups and loads may be made from any thread, concurrently. The
+ * scale and default theme should only be set, and resource paths only
+ * added, from the main thread, which is where property notifications
+ * and signals are emitted.
+ *
+ * The ::icons-changed signal is emitted whenever a name may now look up
+ * a different file: when the default theme changes, or a resource path
+ * is added. It is emitted before notify::default-theme, so anything
+ * remembering lookup results can forget them before icons reload.
  */
 
 CmkIconLoader * cmk_icon_loader_new(void);
@@ -55,8 +65,56 @@ guint cmk_icon_loader_get_scale(CmkIconLoader *loader);
  * to see when the default theme changes in order to update icons live.
  */
 void cmk_icon_loader_set_default_theme(CmkIconLoader *loader, const gchar *theme);
+
+/**
+ * cmk_icon_loader_get_default_theme:
+ *
+ * Returns the default theme's name. Only call this from the main thread;
+ * the string is owned by the loader and is freed when the default theme
+ * changes.
+ */
 const gchar * cmk_icon_loader_get_default_theme(CmkIconLoader *loader);
 
+/**
+ * cmk_icon_loader_dup_default_theme:
+ *
+ * Like cmk_icon_loader_get_default_theme(), but safe to call from any
+ * thread.
+ *
+ * Returns: (transfer full): The default theme's name. Free with g_free.
+ */
+gchar * cmk_icon_loader_dup_default_theme(CmkIconLoader *loader);
+
+/**
+ * cmk_icon_loader_set_use_shared_cache:
+ *
+ * Opt in to sharing decoded icons with other cmk processes of the same
+ * user. When enabled, icons that miss the in-process cache are looked
+ * for in a raster cache in $XDG_RUNTIME_DIR before being decoded, and
+ * icons that do get decoded are added to it, so that the second process
+ * to need an icon maps the first one's pixels instead of decoding them
+ * again. Defaults to %TRUE if the CMK_SHARED_ICON_CACHE environment
+ * variable is set to 1, and %FALSE otherwise.
+ */
+void cmk_icon_loader_set_use_shared_cache(CmkIconLoader *loader, gboolean useSharedCache);
+gboolean cmk_icon_loader_get_use_shared_cache(CmkIconLoader *loader);
+
+/**
+ * cmk_icon_loader_add_resource_path:
+ * @loader: A #CmkIconLoader
+ * @path: A resource path, such as "/org/example/app/icons"
+ *
+ * Adds icons compiled into the app with #GResource. Lookups check them
+ * before any icon theme, so an app can ship and override icons without
+ * installing them. Icons go in subdirectories named like hicolor's,
+ * such as @path/48x48/apps/icon.png, @path/48x48@2/apps/icon.png or
+ * @path/scalable/actions/icon.svg. Icons directly in @path are used as
+ * a last resort at any size. Lookups return "resource://" paths for
+ * these icons, which cmk_icon_loader_load() reads directly from the
+ * resource data, with no file I/O.
+ */
+void cmk_icon_loader_add_resource_path(CmkIconLoader *loader, const gchar *path);
+
 /**
  * cmk_icon_loader_lookup:
  *
@@ -82,6 +140,8 @@ gchar * cmk_icon_loader_lookup(CmkIconLoader *loader, const gchar *name, guint s
  *       icon which can be scaled to the requested size instead.
  * @scale: The current GUI scale. This is probably a DE-global value.
  *        The icon size passed to 'size' must NOT be affected by this scale.
+ *        Groups listed under the theme's ScaledDirectories with a
+ *        matching Scale key are preferred, so scale 2 finds @2x assets.
  *
  * Looks up an icon's file path.
  *
@@ -90,18 +150,84 @@ gchar * cmk_icon_loader_lookup(CmkIconLoader *loader, const gchar *name, guint s
  */
 gchar * cmk_icon_loader_lookup_full(CmkIconLoader *self, const gchar *name, gboolean useFallbackNames, const gchar *theme, gboolean useFallbackTheme, guint size, guint scale);
 
+/**
+ * cmk_icon_loader_lookup_content_type:
+ * @contentType: A content type, such as from g_file_info_get_content_type()
+ * @symbolic: %TRUE to look for the type's symbolic icon
+ * @theme: The icon theme to use, or %NULL for the default
+ * @size: Icon size, not affected by @scale
+ * @scale: The GUI scale
+ *
+ * Looks up the icon for a content type, trying each name GIO gives for
+ * it (see g_content_type_get_icon()) in order. Results are remembered
+ * per content type, size and scale until the theme changes, so that a
+ * list of many files only resolves each type once.
+ *
+ * Returns: The icon's path, or %NULL if none of its names were found.
+ */
+gchar * cmk_icon_loader_lookup_content_type(CmkIconLoader *loader, const gchar *contentType, gboolean symbolic, const gchar *theme, guint size, guint scale);
+
 /**
  * cmk_icon_loader_load:
  *
  * Loads the icon. Set cache to %TRUE if this icon is to be loaded often.
- * If the icon is not inherently scalable (ex SVG), it will not be scaled to
- * match the given size. The returned surface's size should always be checked
- * with cairo_image_surface_check_width/height, and be scaled if necessary.
+ * Icons larger than @size * @scale pixels are scaled down to fit when
+ * loaded, but smaller icons that are not inherently scalable (ex PNG) are
+ * not scaled up. The returned surface's size should always be checked
+ * with cairo_image_surface_get_width/height, and be scaled if necessary.
  * Free the returned surface with cairo_surface_destroy. Do not modify the
  * returned surface, as it may be used in other places if cached.
  */
 cairo_surface_t * cmk_icon_loader_load(CmkIconLoader *loader, const gchar *path, guint size, guint scale, gboolean cache);
 
+/**
+ * cmk_icon_loader_load_mask:
+ *
+ * Like cmk_icon_loader_load(), but only loads the icon's alpha channel,
+ * into a CAIRO_FORMAT_A8 surface. Use this for icons that are only drawn
+ * as a mask, such as symbolic icons colored with the foreground color.
+ * Masks take a quarter of the memory of full icons and are cached
+ * separately from them.
+ */
+cairo_surface_t * cmk_icon_loader_load_mask(CmkIconLoader *loader, const gchar *path, guint size, guint scale, gboolean cache);
+
+/**
+ * cmk_icon_loader_load_batch:
+ * @loader: A #CmkIconLoader
+ * @paths: (array zero-terminated=1): %NULL-terminated list of icon paths
+ * @size: The icon size
+ * @scale: The GUI scale
+ * @cache: If %TRUE, the loaded icons are cached
+ *
+ * Like cmk_icon_loader_load(), but loads many icons at once, decoding
+ * them concurrently on a pool of worker threads. Use this when a whole
+ * set of icons is needed at once, such as for a launcher grid. Blocks
+ * until all icons are loaded.
+ *
+ * Returns: (transfer full): An array with the surface for each entry of
+ * @paths at the same index, or %NULL where loading failed. Destroy each
+ * surface and g_free() the array.
+ */
+cairo_surface_t ** cmk_icon_loader_load_batch(CmkIconLoader *loader, const gchar * const *paths, guint size, guint scale, gboolean cache);
+
+/**
+ * cmk_icon_loader_prefetch:
+ * @loader: A #CmkIconLoader
+ * @names: (array zero-terminated=1): %NULL-terminated list of icon names
+ * @sizes: (array zero-terminated=1): 0-terminated list of icon sizes
+ * @scale: The GUI scale, or 0 to use cmk_icon_loader_get_scale().
+ *
+ * Looks up every icon in @names at every size in @sizes and decodes them
+ * on a pool of background threads, so that a later cmk_icon_loader_load()
+ * or #CmkIcon paint of the same icons is a cache hit. Icons are looked up
+ * in the default theme and the themes it inherits, as by
+ * cmk_icon_loader_lookup_full() with @useFallbackTheme set, and names
+ * that aren't found are skipped. The decoded icons are added to the
+ * cache once they are all ready, and stay cached for the life of the
+ * process.
+ */
+void cmk_icon_loader_prefetch(CmkIconLoader *loader, const gchar * const *names, const guint *sizes, guint scale);
+
 /**
  * cmk_icon_loader_get:
  *
@@ -0,0 +1,63 @@
+/*
+ * libcmk
+ * Copyright (C) 2017 Velt Technologies, Aidan Shafran <zelbrium@gmail.com>
+ * Licensed under the Apache License 2 <www.apache.org/licenses/LICENSE-2.0>.
+ */
+
+#ifndef __CMK_ICON_RASTER_PRIVATE_H__
+#define __CMK_ICON_RASTER_PRIVATE_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+/*
+ * Pixel routines shared by CmkIconLoader and CmkIcon. None of these
+ * touch global state, so they may be called from any thread.
+ * Not installed.
+ */
+
+G_BEGIN_DECLS
+
+/*
+ * Converts @numPixels straight-alpha RGBA pixels (byte order R,G,B,A) to
+ * premultiplied native-endian ARGB32, as used by CAIRO_FORMAT_ARGB32.
+ * @src and @dst may point to the same buffer.
+ */
+G_GNUC_INTERNAL
+void cmk_raster_premultiply_rgba(const guchar *src, guint32 *dst, gsize numPixels);
+
+/*
+ * Decodes a PNG file with libpng directly into a new CAIRO_FORMAT_ARGB32
+ * surface. Returns %NULL on failure.
+ */
+G_GNUC_INTERNAL
+cairo_surface_t * cmk_raster_decode_png(const gchar *path);
+
+/*
+ * Like cmk_raster_decode_png, but decodes PNG data already in memory,
+ * such as from a GResource, without copying it first.
+ */
+G_GNUC_INTERNAL
+cairo_surface_t * cmk_raster_decode_png_data(const guchar *data, gsize length);
+
+/*
+ * Shrinks a CAIRO_FORMAT_ARGB32 surface to exactly @width x @height
+ * pixels using an area-averaging box filter, which is exact for the
+ * premultiplied data and doesn't alias like a point sample would. The
+ * target size must not be larger than the source in either direction.
+ * Returns a new surface, or %NULL on failure.
+ */
+G_GNUC_INTERNAL
+cairo_surface_t * cmk_raster_downscale(cairo_surface_t *src, guint width, guint height);
+
+/*
+ * Copies the alpha channel of a CAIRO_FORMAT_ARGB32 surface into a new
+ * CAIRO_FORMAT_A8 surface, for icons that are only ever used as a mask.
+ * Returns %NULL on failure.
+ */
+G_GNUC_INTERNAL
+cairo_surface_t * cmk_raster_extract_alpha(cairo_surface_t *src);
+
+G_END_DECLS
+
+#endif
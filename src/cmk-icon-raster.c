@@ -0,0 +1,392 @@
+/*
+ * libcmk
+ * Copyright (C) 2017 Velt Technologies, Aidan Shafran <zelbrium@gmail.com>
+ * Licensed under the Apache License 2 <www.apache.org/licenses/LICENSE-2.0>.
+ */
+
+#include "cmk-icon-raster-private.h"
+#include <png.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) && G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define CMK_RASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Largest PNG width or height that will be decoded. Icons are never
+// anywhere near this, so anything bigger is probably a broken file.
+#define MAX_PNG_SIZE 4096
+
+// Exact round(c*a/255) for 8 bit values, without a division
+static inline guint32 mul_un8(guint32 c, guint32 a)
+{
+	guint32 t = c*a + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+#ifdef CMK_RASTER_SSE2
+/*
+ * Premultiplies two RGBA pixels held in 16 bit lanes, and swaps R and B
+ * so that the packed result is BGRA in memory, which is ARGB32 on little
+ * endian. Uses the same rounding as mul_un8.
+ */
+static inline __m128i premultiply_2px(__m128i px)
+{
+	const __m128i keepAlpha = _mm_set_epi16(0xff, 0, 0, 0, 0xff, 0, 0, 0);
+	const __m128i half = _mm_set1_epi16(128);
+
+	px = _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 0, 1, 2));
+	px = _mm_shufflehi_epi16(px, _MM_SHUFFLE(3, 0, 1, 2));
+
+	// Broadcast each pixel's alpha over its lanes, but multiply the
+	// alpha lane itself by 255 so that it comes out unchanged.
+	__m128i alpha = _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+	alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+	alpha = _mm_or_si128(alpha, keepAlpha);
+
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(px, alpha), half);
+	t = _mm_add_epi16(t, _mm_srli_epi16(t, 8));
+	return _mm_srli_epi16(t, 8);
+}
+#endif
+
+void cmk_raster_premultiply_rgba(const guchar *src, guint32 *dst, gsize numPixels)
+{
+	gsize i = 0;
+#ifdef CMK_RASTER_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for(; i+4 <= numPixels; i += 4)
+	{
+		__m128i px = _mm_loadu_si128((const __m128i *)(src + i*4));
+		__m128i lo = premultiply_2px(_mm_unpacklo_epi8(px, zero));
+		__m128i hi = premultiply_2px(_mm_unpackhi_epi8(px, zero));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for(; i<numPixels; ++i)
+	{
+		const guchar *p = src + i*4;
+		guint32 a = p[3];
+		dst[i] = (a << 24)
+			| (mul_un8(p[0], a) << 16)
+			| (mul_un8(p[1], a) << 8)
+			| mul_un8(p[2], a);
+	}
+}
+
+static void extract_alpha_row(const guint32 *src, guchar *dst, gsize numPixels)
+{
+	gsize i = 0;
+#ifdef CMK_RASTER_SSE2
+	for(; i+16 <= numPixels; i += 16)
+	{
+		__m128i a = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + i)), 24);
+		__m128i b = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + i + 4)), 24);
+		__m128i c = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + i + 8)), 24);
+		__m128i d = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + i + 12)), 24);
+		__m128i ab = _mm_packs_epi32(a, b);
+		__m128i cd = _mm_packs_epi32(c, d);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(ab, cd));
+	}
+#endif
+	for(; i<numPixels; ++i)
+		dst[i] = src[i] >> 24;
+}
+
+cairo_surface_t * cmk_raster_extract_alpha(cairo_surface_t *src)
+{
+	if(cairo_image_surface_get_format(src) != CAIRO_FORMAT_ARGB32)
+		return NULL;
+	cairo_surface_flush(src);
+
+	guint width = cairo_image_surface_get_width(src);
+	guint height = cairo_image_surface_get_height(src);
+	cairo_surface_t *dst = cairo_image_surface_create(CAIRO_FORMAT_A8, width, height);
+	if(cairo_surface_status(dst) != CAIRO_STATUS_SUCCESS)
+	{
+		cairo_surface_destroy(dst);
+		return NULL;
+	}
+
+	const guchar *srcData = cairo_image_surface_get_data(src);
+	guchar *dstData = cairo_image_surface_get_data(dst);
+	gsize srcStride = cairo_image_surface_get_stride(src);
+	gsize dstStride = cairo_image_surface_get_stride(dst);
+	for(guint y=0;y<height;++y)
+		extract_alpha_row((const guint32 *)(srcData + y*srcStride), dstData + y*dstStride, width);
+
+	cairo_surface_mark_dirty(dst);
+	return dst;
+}
+
+/*
+ * A pixel as four float channels, for the box filter. The channel order
+ * doesn't matter, since every channel is filtered the same way.
+ */
+#ifdef CMK_RASTER_SSE2
+typedef __m128 Px;
+static inline Px px_zero(void) { return _mm_setzero_ps(); }
+static inline Px px_load(const gfloat *p) { return _mm_loadu_ps(p); }
+static inline void px_store(gfloat *p, Px px) { _mm_storeu_ps(p, px); }
+static inline Px px_madd(Px acc, Px px, gfloat w) { return _mm_add_ps(acc, _mm_mul_ps(px, _mm_set1_ps(w))); }
+static inline Px px_unpack(guint32 v)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i i = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(i, zero));
+}
+static inline guint32 px_pack(Px px)
+{
+	__m128i i = _mm_cvtps_epi32(px); // Rounds to nearest
+	i = _mm_packs_epi32(i, i);
+	return _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+}
+#else
+typedef struct { gfloat c[4]; } Px;
+static inline Px px_zero(void) { Px px = {{0, 0, 0, 0}}; return px; }
+static inline Px px_load(const gfloat *p) { Px px = {{p[0], p[1], p[2], p[3]}}; return px; }
+static inline void px_store(gfloat *p, Px px) { memcpy(p, px.c, sizeof(px.c)); }
+static inline Px px_madd(Px acc, Px px, gfloat w)
+{
+	for(guint i=0;i<4;++i)
+		acc.c[i] += px.c[i] * w;
+	return acc;
+}
+static inline Px px_unpack(guint32 v)
+{
+	Px px = {{v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24}};
+	return px;
+}
+static inline guint32 px_pack(Px px)
+{
+	guint32 v = 0;
+	for(guint i=0;i<4;++i)
+		v |= (guint32)CLAMP(px.c[i] + 0.5f, 0, 255) << (i*8);
+	return v;
+}
+#endif
+
+/*
+ * The source pixels covered by one destination pixel along an axis, and
+ * how much of each one is covered. Weights sum to 1.
+ */
+typedef struct
+{
+	guint start;
+	guint count;
+	gfloat *weights;
+} BoxSpan;
+
+static BoxSpan * box_spans_new(guint srcLength, guint dstLength)
+{
+	gdouble ratio = (gdouble)srcLength / dstLength;
+	guint maxCount = (guint)ratio + 2;
+	BoxSpan *spans = g_new(BoxSpan, dstLength);
+	gfloat *weights = g_new(gfloat, dstLength * maxCount);
+
+	for(guint i=0;i<dstLength;++i)
+	{
+		gdouble a = i * ratio;
+		gdouble b = MIN((i+1) * ratio, srcLength);
+		BoxSpan *span = &spans[i];
+		span->start = (guint)a;
+		span->count = 0;
+		span->weights = weights + i*maxCount;
+		for(guint j=span->start;j<b && span->count<maxCount;++j)
+		{
+			gdouble overlap = MIN(j+1, b) - MAX(j, a);
+			span->weights[span->count++] = overlap / ratio;
+		}
+	}
+	return spans;
+}
+
+static void box_spans_free(BoxSpan *spans)
+{
+	g_free(spans[0].weights);
+	g_free(spans);
+}
+
+cairo_surface_t * cmk_raster_downscale(cairo_surface_t *src, guint width, guint height)
+{
+	g_return_val_if_fail(cairo_image_surface_get_format(src) == CAIRO_FORMAT_ARGB32, NULL);
+	guint srcWidth = cairo_image_surface_get_width(src);
+	guint srcHeight = cairo_image_surface_get_height(src);
+	g_return_val_if_fail(width > 0 && height > 0 && width <= srcWidth && height <= srcHeight, NULL);
+
+	cairo_surface_t *dst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(dst) != CAIRO_STATUS_SUCCESS)
+	{
+		cairo_surface_destroy(dst);
+		return NULL;
+	}
+
+	cairo_surface_flush(src);
+	const guchar *srcData = cairo_image_surface_get_data(src);
+	gint srcStride = cairo_image_surface_get_stride(src);
+	guchar *dstData = cairo_image_surface_get_data(dst);
+	gint dstStride = cairo_image_surface_get_stride(dst);
+
+	BoxSpan *xSpans = box_spans_new(srcWidth, width);
+	BoxSpan *ySpans = box_spans_new(srcHeight, height);
+
+	// Horizontal pass over every source row, then vertical pass from that
+	gfloat *tmp = g_new(gfloat, (gsize)srcHeight * width * 4);
+	for(guint y=0;y<srcHeight;++y)
+	{
+		const guint32 *row = (const guint32 *)(srcData + y*srcStride);
+		gfloat *out = tmp + (gsize)y*width*4;
+		for(guint x=0;x<width;++x)
+		{
+			const BoxSpan *span = &xSpans[x];
+			Px acc = px_zero();
+			for(guint i=0;i<span->count;++i)
+				acc = px_madd(acc, px_unpack(row[span->start+i]), span->weights[i]);
+			px_store(out + x*4, acc);
+		}
+	}
+
+	for(guint y=0;y<height;++y)
+	{
+		const BoxSpan *span = &ySpans[y];
+		guint32 *out = (guint32 *)(dstData + y*dstStride);
+		for(guint x=0;x<width;++x)
+		{
+			Px acc = px_zero();
+			for(guint i=0;i<span->count;++i)
+				acc = px_madd(acc, px_load(tmp + ((gsize)(span->start+i)*width + x)*4), span->weights[i]);
+			out[x] = px_pack(acc);
+		}
+	}
+
+	g_free(tmp);
+	box_spans_free(xSpans);
+	box_spans_free(ySpans);
+
+	cairo_surface_mark_dirty(dst);
+	return dst;
+}
+
+static void png_error_fn(png_structp png, UNUSED png_const_charp message)
+{
+	png_longjmp(png, 1);
+}
+
+static void png_warning_fn(UNUSED png_structp png, UNUSED png_const_charp message)
+{
+	// Icon themes are full of PNGs with harmless warnings (mostly
+	// iCCP profile complaints); don't spam stderr with them.
+}
+
+typedef struct
+{
+	const guchar *data;
+	gsize length;
+	gsize offset;
+} PngBuffer;
+
+static void png_read_buffer_fn(png_structp png, png_bytep out, png_size_t length)
+{
+	PngBuffer *buffer = png_get_io_ptr(png);
+	if(length > buffer->length - buffer->offset)
+		png_error(png, "Unexpected end of data");
+	memcpy(out, buffer->data + buffer->offset, length);
+	buffer->offset += length;
+}
+
+/*
+ * Reads with libpng straight into the cairo surface's buffer: libpng
+ * expands every input format to 8 bit RGBA rows that are written in place,
+ * and then each row is premultiplied and swizzled to ARGB32 in place.
+ * cairo_image_surface_create_from_png instead decodes through its own
+ * row callbacks and per-pixel conversion. Reads from file if it is set,
+ * and from buffer otherwise.
+ */
+static cairo_surface_t * decode_png(FILE *file, PngBuffer *buffer)
+{
+	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, png_error_fn, png_warning_fn);
+	png_infop info = png ? png_create_info_struct(png) : NULL;
+	if(!info)
+	{
+		png_destroy_read_struct(&png, NULL, NULL);
+		return NULL;
+	}
+
+	// Modified after setjmp, so must be volatile to survive the longjmp
+	cairo_surface_t * volatile surface = NULL;
+	png_bytep * volatile rows = NULL;
+
+	if(setjmp(png_jmpbuf(png)))
+	{
+		if(surface)
+			cairo_surface_destroy(surface);
+		g_free(rows);
+		png_destroy_read_struct(&png, &info, NULL);
+		return NULL;
+	}
+
+	if(file)
+		png_init_io(png, file);
+	else
+		png_set_read_fn(png, buffer, png_read_buffer_fn);
+	png_set_user_limits(png, MAX_PNG_SIZE, MAX_PNG_SIZE);
+	png_read_info(png, info);
+
+	png_uint_32 width, height;
+	int depth, colorType;
+	png_get_IHDR(png, info, &width, &height, &depth, &colorType, NULL, NULL, NULL);
+
+	// Expand everything to 8 bit RGBA
+	if(colorType == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(png);
+	if(colorType == PNG_COLOR_TYPE_GRAY && depth < 8)
+		png_set_expand_gray_1_2_4_to_8(png);
+	if(png_get_valid(png, info, PNG_INFO_tRNS))
+		png_set_tRNS_to_alpha(png);
+	if(depth == 16)
+		png_set_strip_16(png);
+	if(colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_gray_to_rgb(png);
+	png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+	png_set_interlace_handling(png);
+	png_read_update_info(png, info);
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+		png_longjmp(png, 1);
+
+	guchar *data = cairo_image_surface_get_data(surface);
+	gint stride = cairo_image_surface_get_stride(surface);
+	rows = g_new(png_bytep, height);
+	for(png_uint_32 y=0;y<height;++y)
+		rows[y] = data + y*stride;
+
+	png_read_image(png, rows);
+	png_read_end(png, NULL);
+
+	for(png_uint_32 y=0;y<height;++y)
+		cmk_raster_premultiply_rgba(rows[y], (guint32 *)rows[y], width);
+
+	g_free(rows);
+	png_destroy_read_struct(&png, &info, NULL);
+
+	cairo_surface_mark_dirty(surface);
+	return surface;
+}
+
+cairo_surface_t * cmk_raster_decode_png(const gchar *path)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file)
+		return NULL;
+	cairo_surface_t *surface = decode_png(file, NULL);
+	fclose(file);
+	return surface;
+}
+
+cairo_surface_t * cmk_raster_decode_png_data(const guchar *data, gsize length)
+{
+	PngBuffer buffer = {data, length, 0};
+	return decode_png(NULL, &buffer);
+}
@@ -0,0 +1,92 @@
+/*
+ * libcmk
+ * Copyright (C) 2017 Velt Technologies, Aidan Shafran <zelbrium@gmail.com>
+ * Licensed under the Apache License 2 <www.apache.org/licenses/LICENSE-2.0>.
+ */
+
+#ifndef __CMK_ICON_TEXTURE_PRIVATE_H__
+#define __CMK_ICON_TEXTURE_PRIVATE_H__
+
+#include <glib.h>
+#include <cairo.h>
+#include <cogl/cogl.h>
+#include "cmk-icon.h"
+
+/*
+ * GPU textures for CmkIcon. Icons loaded from a file are shared: every
+ * CmkIcon showing the same file at the same pixel size (and in the same
+ * mode, full color or mask) references one refcounted CmkIconTexture,
+ * so a view of 200 folder icons uploads a single texture. An entry is
+ * forgotten when its last reference is dropped. Small shared icons are
+ * packed into atlas pages, so an icon's image may only be part of its
+ * texture. These use Cogl, so they
+ * must only be called from the main thread. Not installed.
+ */
+
+G_BEGIN_DECLS
+
+typedef struct _CmkIconTexture CmkIconTexture;
+
+struct _CmkIconTexture
+{
+	CoglTexture *texture;
+	guint width, height; // Of the image, in pixels
+	gfloat s1, t1, s2, t2; // Texture coordinates of the image
+
+	/*< private >*/
+	gint refcount;
+	gchar *key;
+	gpointer shelf; // Atlas shelf holding the image, if any
+	guint slotX;
+};
+
+/*
+ * Finds the shared texture of an icon file at a pixel size, already
+ * multiplied by the scale. Returns a new reference, or %NULL if no icon
+ * is using it.
+ */
+G_GNUC_INTERNAL
+CmkIconTexture * cmk_icon_texture_lookup(const gchar *path, guint pixelSize, gboolean mask);
+
+/*
+ * Uploads @surface (CAIRO_FORMAT_ARGB32 or CAIRO_FORMAT_A8). If @path is
+ * not %NULL, the texture is shared under it and @pixelSize for later
+ * cmk_icon_texture_lookup calls; otherwise it belongs to the caller
+ * alone. Returns %NULL if the upload fails.
+ */
+G_GNUC_INTERNAL
+CmkIconTexture * cmk_icon_texture_new(const gchar *path, guint pixelSize, gboolean mask, cairo_surface_t *surface);
+
+/*
+ * Uploads the @frames frames of a pixmap animation, each a @size x @size
+ * image in @format with cairo's stride, stored one after another in
+ * @data, into one unshared texture. The texture coordinates cover the
+ * first frame. Frame n is n % *@framesPerRow steps of *@stepS to the
+ * right of it and n / *@framesPerRow steps of *@stepT down. Returns
+ * %NULL if the frames don't fit in a texture.
+ */
+G_GNUC_INTERNAL
+CmkIconTexture * cmk_icon_texture_new_frames(const guchar *data, cairo_format_t format, guint size, guint frames, guint *framesPerRow, gfloat *stepS, gfloat *stepT);
+
+G_GNUC_INTERNAL
+CmkIconTexture * cmk_icon_texture_ref(CmkIconTexture *texture);
+G_GNUC_INTERNAL
+void cmk_icon_texture_unref(CmkIconTexture *texture);
+
+/*
+ * Counts an icon drawn with @texture for cmk_icon_get_texture_stats.
+ * Consecutive draws from the same texture count as one texture switch.
+ */
+G_GNUC_INTERNAL
+void cmk_icon_texture_note_draw(CmkIconTexture *texture);
+
+/*
+ * Notes that something other than an icon texture was drawn, so the
+ * next icon counts as a texture switch.
+ */
+G_GNUC_INTERNAL
+void cmk_icon_texture_note_other_draw(void);
+
+G_END_DECLS
+
+#endif
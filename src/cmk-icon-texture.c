@@ -0,0 +1,471 @@
+/*
+ * libcmk
+ * Copyright (C) 2017 Velt Technologies, Aidan Shafran <zelbrium@gmail.com>
+ * Licensed under the Apache License 2 <www.apache.org/licenses/LICENSE-2.0>.
+ */
+
+#include "cmk-icon-texture-private.h"
+#include <clutter/clutter.h>
+#include <string.h>
+
+/*
+ * Shared icons of ATLAS_MAX_ICON pixels or less are packed into
+ * ATLAS_PAGE_SIZE square atlas pages, so that a screen of icons samples
+ * from a few textures and Cogl's journal can batch them into a few
+ * draws. Each page is split into shelves, and each shelf into square
+ * slots of one size class, so a slot freed by one icon fits the next
+ * icon of that class. Every image is surrounded by a transparent
+ * ATLAS_PADDING pixel border, so linear filtering doesn't bleed in
+ * neighbours. Full color and mask icons use separate pages, since
+ * their texture formats differ. Set CMK_ICON_ATLAS=0 to disable.
+ *
+ * A shelf left empty is given to whichever size class next needs one
+ * that fits, or dropped if it is the last on its page, and a page left
+ * empty is freed. At most ATLAS_MAX_PAGES pages exist at once; icons
+ * that don't fit then get textures of their own.
+ */
+#define ATLAS_PAGE_SIZE 1024
+#define ATLAS_MAX_ICON 128
+#define ATLAS_PADDING 1
+#define ATLAS_MAX_PAGES 8
+
+typedef struct _AtlasPage AtlasPage;
+
+typedef struct
+{
+	AtlasPage *page;
+	guint y;
+	guint height; // At least slotSize, if the shelf has been reused
+	guint slotSize;
+	guint nextX; // Slots up to here have been used at some point
+	GArray *freeSlots; // guint x of each slot given back
+	guint numIcons;
+} AtlasShelf;
+
+struct _AtlasPage
+{
+	CoglTexture *texture;
+	gboolean mask;
+	guint nextY;
+	GPtrArray *shelves; // In order of y
+	guint numIcons;
+	guint64 usedPixels; // Image pixels, not counting padding
+};
+
+static GPtrArray *atlasPages = NULL;
+static gint useAtlas = -1;
+
+// Key: texture_key(), value: CmkIconTexture * (not referenced; entries
+// remove themselves when freed)
+static GHashTable *sharedTextures = NULL;
+static guint numStandalone = 0;
+
+static guint numIconsDrawn = 0;
+static guint numTextureSwitches = 0;
+static CoglTexture *lastDrawnTexture = NULL;
+
+static CoglContext * get_cogl_context(void)
+{
+	return clutter_backend_get_cogl_context(clutter_get_default_backend());
+}
+
+static gchar * texture_key(const gchar *path, guint pixelSize, gboolean mask)
+{
+	return g_strdup_printf("%u:%s:%s", pixelSize, mask ? "a8" : "", path);
+}
+
+static guint slot_size_for(guint width, guint height)
+{
+	// Size classes in steps of 8 pixels, so nearby sizes share shelves
+	guint size = MAX(width, height) + ATLAS_PADDING*2;
+	return (size + 7) & ~7u;
+}
+
+static AtlasShelf * find_shelf(AtlasPage *page, guint slotSize, guint *x)
+{
+	AtlasShelf *empty = NULL;
+	for(guint i=0;i<page->shelves->len;++i)
+	{
+		AtlasShelf *shelf = g_ptr_array_index(page->shelves, i);
+		if(shelf->numIcons == 0 && shelf->height >= slotSize
+		&& (!empty || shelf->height < empty->height))
+			empty = shelf;
+		if(shelf->slotSize != slotSize)
+			continue;
+		if(shelf->freeSlots->len > 0)
+		{
+			*x = g_array_index(shelf->freeSlots, guint, shelf->freeSlots->len - 1);
+			g_array_set_size(shelf->freeSlots, shelf->freeSlots->len - 1);
+			return shelf;
+		}
+		if(shelf->nextX + slotSize <= ATLAS_PAGE_SIZE)
+		{
+			*x = shelf->nextX;
+			shelf->nextX += slotSize;
+			return shelf;
+		}
+	}
+
+	// Give the tightest fitting empty shelf to this size class
+	AtlasShelf *shelf = empty;
+	if(!shelf)
+	{
+		if(page->nextY + slotSize > ATLAS_PAGE_SIZE)
+			return NULL;
+		shelf = g_new0(AtlasShelf, 1);
+		shelf->page = page;
+		shelf->y = page->nextY;
+		shelf->height = slotSize;
+		shelf->freeSlots = g_array_new(FALSE, FALSE, sizeof(guint));
+		page->nextY += slotSize;
+		g_ptr_array_add(page->shelves, shelf);
+	}
+	shelf->slotSize = slotSize;
+	g_array_set_size(shelf->freeSlots, 0);
+	shelf->nextX = slotSize;
+	*x = 0;
+	return shelf;
+}
+
+static void free_atlas_shelf(AtlasShelf *shelf)
+{
+	g_array_unref(shelf->freeSlots);
+	g_free(shelf);
+}
+
+static AtlasPage * new_atlas_page(gboolean mask)
+{
+	if(atlasPages && atlasPages->len >= ATLAS_MAX_PAGES)
+		return NULL;
+	CoglTexture *tex = COGL_TEXTURE(cogl_texture_2d_new_with_size(get_cogl_context(), ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE));
+	if(mask)
+		cogl_texture_set_components(tex, COGL_TEXTURE_COMPONENTS_A);
+	if(!cogl_texture_allocate(tex, NULL))
+	{
+		cogl_object_unref(tex);
+		return NULL;
+	}
+
+	AtlasPage *page = g_new0(AtlasPage, 1);
+	page->texture = tex;
+	page->mask = mask;
+	page->shelves = g_ptr_array_new_with_free_func((GDestroyNotify)free_atlas_shelf);
+	if(!atlasPages)
+		atlasPages = g_ptr_array_new();
+	g_ptr_array_add(atlasPages, page);
+	return page;
+}
+
+static void free_atlas_page(AtlasPage *page)
+{
+	g_ptr_array_remove(atlasPages, page);
+	g_ptr_array_unref(page->shelves);
+	cogl_object_unref(page->texture);
+	g_free(page);
+}
+
+/*
+ * Copies a surface into an atlas slot, along with its transparent
+ * border. The whole slot is written, so nothing of the slot's previous
+ * icon is left behind.
+ */
+static gboolean upload_to_slot(AtlasShelf *shelf, guint x, cairo_surface_t *surface)
+{
+	guint size = shelf->slotSize;
+	gboolean mask = shelf->page->mask;
+	guint bpp = mask ? 1 : 4;
+	guint width = cairo_image_surface_get_width(surface);
+	guint height = cairo_image_surface_get_height(surface);
+	guint srcStride = cairo_image_surface_get_stride(surface);
+	const guchar *src = cairo_image_surface_get_data(surface);
+
+	guchar *slot = g_malloc0(size * size * bpp);
+	for(guint row=0;row<height;++row)
+		memcpy(slot + ((row+ATLAS_PADDING)*size + ATLAS_PADDING)*bpp, src + row*srcStride, width*bpp);
+
+	gboolean r = cogl_texture_set_region(shelf->page->texture,
+		0, 0,
+		x, shelf->y,
+		size, size,
+		size, size,
+		mask ? COGL_PIXEL_FORMAT_A_8 : CLUTTER_CAIRO_FORMAT_ARGB32,
+		size * bpp,
+		slot);
+	g_free(slot);
+	return r;
+}
+
+static gboolean add_to_atlas(CmkIconTexture *texture, cairo_surface_t *surface)
+{
+	if(useAtlas < 0)
+		useAtlas = (g_strcmp0(g_getenv("CMK_ICON_ATLAS"), "0") != 0);
+	if(!useAtlas || texture->width > ATLAS_MAX_ICON || texture->height > ATLAS_MAX_ICON)
+		return FALSE;
+
+	gboolean mask = (cairo_image_surface_get_format(surface) == CAIRO_FORMAT_A8);
+	guint slotSize = slot_size_for(texture->width, texture->height);
+	AtlasShelf *shelf = NULL;
+	guint x = 0;
+	for(guint i=0;atlasPages && i<atlasPages->len && !shelf;++i)
+	{
+		AtlasPage *page = g_ptr_array_index(atlasPages, i);
+		if(page->mask == mask)
+			shelf = find_shelf(page, slotSize, &x);
+	}
+	if(!shelf)
+	{
+		AtlasPage *page = new_atlas_page(mask);
+		if(!page || !(shelf = find_shelf(page, slotSize, &x)))
+			return FALSE;
+	}
+
+	AtlasPage *page = shelf->page;
+	if(!upload_to_slot(shelf, x, surface))
+	{
+		g_array_append_val(shelf->freeSlots, x);
+		if(page->numIcons == 0)
+			free_atlas_page(page);
+		return FALSE;
+	}
+
+	shelf->numIcons++;
+	page->numIcons++;
+	page->usedPixels += texture->width * texture->height;
+	texture->texture = cogl_object_ref(page->texture);
+	texture->shelf = shelf;
+	texture->slotX = x;
+	texture->s1 = (gfloat)(x + ATLAS_PADDING) / ATLAS_PAGE_SIZE;
+	texture->t1 = (gfloat)(shelf->y + ATLAS_PADDING) / ATLAS_PAGE_SIZE;
+	texture->s2 = texture->s1 + (gfloat)texture->width / ATLAS_PAGE_SIZE;
+	texture->t2 = texture->t1 + (gfloat)texture->height / ATLAS_PAGE_SIZE;
+	return TRUE;
+}
+
+static void remove_from_atlas(CmkIconTexture *texture)
+{
+	AtlasShelf *shelf = texture->shelf;
+	AtlasPage *page = shelf->page;
+	texture->shelf = NULL;
+	g_array_append_val(shelf->freeSlots, texture->slotX);
+	shelf->numIcons--;
+	page->numIcons--;
+	page->usedPixels -= texture->width * texture->height;
+
+	// The caller still holds a reference to the page's texture, so
+	// freeing the page here doesn't free the texture under it
+	if(page->numIcons == 0)
+	{
+		free_atlas_page(page);
+		return;
+	}
+
+	// Empty shelves at the bottom go back to the page's free space
+	while(page->shelves->len > 0)
+	{
+		AtlasShelf *last = g_ptr_array_index(page->shelves, page->shelves->len - 1);
+		if(last->numIcons > 0)
+			break;
+		page->nextY = last->y;
+		g_ptr_array_remove_index(page->shelves, page->shelves->len - 1);
+	}
+}
+
+CmkIconTexture * cmk_icon_texture_lookup(const gchar *path, guint pixelSize, gboolean mask)
+{
+	if(!sharedTextures || !path)
+		return NULL;
+	gchar *key = texture_key(path, pixelSize, mask);
+	CmkIconTexture *texture = g_hash_table_lookup(sharedTextures, key);
+	g_free(key);
+	return texture ? cmk_icon_texture_ref(texture) : NULL;
+}
+
+CmkIconTexture * cmk_icon_texture_new(const gchar *path, guint pixelSize, gboolean mask, cairo_surface_t *surface)
+{
+	g_return_val_if_fail(surface, NULL);
+
+	cairo_surface_flush(surface);
+	CmkIconTexture *texture = g_new0(CmkIconTexture, 1);
+	texture->refcount = 1;
+	texture->width = cairo_image_surface_get_width(surface);
+	texture->height = cairo_image_surface_get_height(surface);
+
+	// Only shared icons go in the atlas. Pixmaps are often replaced, and
+	// would churn it.
+	if(!path || !add_to_atlas(texture, surface))
+	{
+		CoglPixelFormat format = (cairo_image_surface_get_format(surface) == CAIRO_FORMAT_A8)
+			? COGL_PIXEL_FORMAT_A_8
+			: CLUTTER_CAIRO_FORMAT_ARGB32;
+		CoglTexture2D *tex = cogl_texture_2d_new_from_data(get_cogl_context(),
+			texture->width, texture->height,
+			format,
+			cairo_image_surface_get_stride(surface),
+			cairo_image_surface_get_data(surface),
+			NULL);
+		if(!tex)
+		{
+			g_free(texture);
+			return NULL;
+		}
+		texture->texture = COGL_TEXTURE(tex);
+		texture->s2 = texture->t2 = 1;
+		numStandalone++;
+	}
+
+	if(path)
+	{
+		if(!sharedTextures)
+			sharedTextures = g_hash_table_new(g_str_hash, g_str_equal);
+		texture->key = texture_key(path, pixelSize, mask);
+		// An entry that's already there keeps working for its users, but
+		// new lookups get this one
+		g_hash_table_replace(sharedTextures, texture->key, texture);
+	}
+	return texture;
+}
+
+/*
+ * A still pixmap is uploaded straight from the caller's buffer. The
+ * frames of an animation are copied into a near-square grid, each in a
+ * cell with a FRAME_PADDING pixel transparent border, so linear
+ * filtering doesn't bleed in the neighbouring frames and long
+ * animations don't run past the maximum texture size.
+ */
+#define FRAME_PADDING 1
+#define MAX_FRAMES_TEXTURE_SIZE 4096
+
+CmkIconTexture * cmk_icon_texture_new_frames(const guchar *data, cairo_format_t format, guint size, guint frames, guint *framesPerRow, gfloat *stepS, gfloat *stepT)
+{
+	g_return_val_if_fail(data && size > 0 && frames > 0, NULL);
+
+	guint stride = cairo_format_stride_for_width(format, size);
+	CoglPixelFormat pixelFormat = (format == CAIRO_FORMAT_A8) ? COGL_PIXEL_FORMAT_A_8 : CLUTTER_CAIRO_FORMAT_ARGB32;
+
+	guint columns = 1, rows = 1, cell = size, pad = 0;
+	guint texW = size, texH = size;
+	guint texStride = stride;
+	const guchar *texData = data;
+	guchar *grid = NULL;
+	if(frames > 1)
+	{
+		while(columns * columns < frames)
+			++columns;
+		rows = (frames + columns - 1) / columns;
+		pad = FRAME_PADDING;
+		cell = size + 2 * pad;
+		if((guint64)cell * columns > MAX_FRAMES_TEXTURE_SIZE)
+			return NULL;
+		texW = cell * columns;
+		texH = cell * rows;
+
+		guint bpp = (format == CAIRO_FORMAT_A8) ? 1 : 4;
+		texStride = texW * bpp;
+		grid = g_malloc0((gsize)texStride * texH);
+		for(guint f=0;f<frames;++f)
+		{
+			const guchar *src = data + (gsize)f * stride * size;
+			guchar *dst = grid + ((f / columns) * cell + pad) * (gsize)texStride + ((f % columns) * cell + pad) * bpp;
+			for(guint row=0;row<size;++row)
+				memcpy(dst + row*texStride, src + row*stride, size*bpp);
+		}
+		texData = grid;
+	}
+
+	CoglTexture2D *tex = cogl_texture_2d_new_from_data(get_cogl_context(),
+		texW, texH,
+		pixelFormat,
+		texStride,
+		texData,
+		NULL);
+	g_free(grid);
+	if(!tex)
+		return NULL;
+
+	CmkIconTexture *texture = g_new0(CmkIconTexture, 1);
+	texture->refcount = 1;
+	texture->texture = COGL_TEXTURE(tex);
+	texture->width = texture->height = size;
+	texture->s1 = (gfloat)pad / texW;
+	texture->t1 = (gfloat)pad / texH;
+	texture->s2 = (gfloat)(pad + size) / texW;
+	texture->t2 = (gfloat)(pad + size) / texH;
+	numStandalone++;
+	if(framesPerRow)
+		*framesPerRow = columns;
+	if(stepS)
+		*stepS = (gfloat)cell / texW;
+	if(stepT)
+		*stepT = (gfloat)cell / texH;
+	return texture;
+}
+
+CmkIconTexture * cmk_icon_texture_ref(CmkIconTexture *texture)
+{
+	g_return_val_if_fail(texture, NULL);
+	++texture->refcount;
+	return texture;
+}
+
+void cmk_icon_texture_unref(CmkIconTexture *texture)
+{
+	g_return_if_fail(texture);
+	if(--texture->refcount > 0)
+		return;
+
+	if(texture->key && g_hash_table_lookup(sharedTextures, texture->key) == texture)
+		g_hash_table_remove(sharedTextures, texture->key);
+	if(texture->shelf)
+		remove_from_atlas(texture);
+	else
+		numStandalone--;
+	if(lastDrawnTexture == texture->texture)
+		lastDrawnTexture = NULL;
+	g_free(texture->key);
+	cogl_object_unref(texture->texture);
+	g_free(texture);
+}
+
+void cmk_icon_texture_note_draw(CmkIconTexture *texture)
+{
+	numIconsDrawn++;
+	if(texture->texture != lastDrawnTexture)
+	{
+		numTextureSwitches++;
+		lastDrawnTexture = texture->texture;
+	}
+}
+
+void cmk_icon_texture_note_other_draw(void)
+{
+	lastDrawnTexture = NULL;
+}
+
+void cmk_icon_get_texture_stats(CmkIconTextureStats *stats)
+{
+	g_return_if_fail(stats);
+	memset(stats, 0, sizeof(CmkIconTextureStats));
+	stats->standaloneTextures = numStandalone;
+	stats->iconsDrawn = numIconsDrawn;
+	stats->textureSwitches = numTextureSwitches;
+	if(!atlasPages)
+		return;
+
+	guint64 used = 0;
+	for(guint i=0;i<atlasPages->len;++i)
+	{
+		AtlasPage *page = g_ptr_array_index(atlasPages, i);
+		stats->atlasIcons += page->numIcons;
+		used += page->usedPixels;
+	}
+	stats->atlasPages = atlasPages->len;
+	if(atlasPages->len > 0)
+		stats->atlasOccupancy = (gdouble)used / ((guint64)ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * atlasPages->len);
+}
+
+void cmk_icon_reset_draw_stats(void)
+{
+	numIconsDrawn = 0;
+	numTextureSwitches = 0;
+	lastDrawnTexture = NULL;
+}
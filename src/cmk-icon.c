@@ -6,18 +6,51 @@
 
 #include "cmk-icon.h"
 #include "cmk-icon-loader.h"
+#include "cmk-icon-texture-private.h"
+#include "cmk-icon-raster-private.h"
+#include <cogl/cogl.h>
 #include <math.h>
-#include <string.h>
+
+// Pixel sizes of the mip levels: 16, 32, 64, 128 and 256
+#define NUM_MIP_LEVELS 5
+#define MIP_LEVEL_SIZE(level) (16u << (level))
+#define SIZE_SETTLE_DELAY 150
 
 typedef struct _CmkIconPrivate CmkIconPrivate;
 struct _CmkIconPrivate {
 	gchar *iconName;
+	gchar *contentType; // Only used if iconName is NULL
 	gchar *themeName;
 	gboolean useForegroundColor;
 	CmkIconLoader *loader;
-	cairo_surface_t *iconSurface;
+	CmkIconTexture *texture;
+	CoglPipeline *pipeline; // Made for the current useForegroundColor
 	gboolean setPixmap;
+
+	// Animated pixmaps. All frames are in the texture, and the animation
+	// only moves the texture coordinates.
+	guint numFrames;
+	guint framesPerRow;
+	gfloat frameStepS, frameStepT;
+	guint frame;
+	ClutterTimeline *animation;
 	gboolean dirty;
+	guint generation; // Bumped whenever a pending background load goes stale
+	gboolean loadSynchronously;
+	gboolean loading; // Waiting on a background load
+	gchar *placeholderColor; // Named color drawn while loading, or NULL
+	CoglPipeline *placeholderPipeline;
+	ClutterTimeline *fadeIn;
+	gboolean queued; // In pendingLoads
+
+	// Size animation. The mips are the icon at power-of-two pixel sizes,
+	// drawn instead of the texture while the size is changing.
+	gboolean animateSize;
+	gboolean sizeChanging; // Until the exact size texture is set
+	guint settleSource;
+	CmkIconTexture *mips[NUM_MIP_LEVELS];
+	gboolean mipsPending;
+	guint mipGeneration; // Bumped whenever the mips go stale
 
 	// A size "request" for the actor. Can be scaled by the style scale
 	// factor. If this is <=0, the actor's standard allocated size is used.
@@ -27,9 +60,13 @@ struct _CmkIconPrivate {
 enum
 {
 	PROP_ICON_NAME = 1,
+	PROP_CONTENT_TYPE,
 	PROP_ICON_THEME,
 	PROP_ICON_SIZE,
 	PROP_USE_FOREGROUND_COLOR,
+	PROP_LOAD_SYNCHRONOUSLY,
+	PROP_PLACEHOLDER_COLOR,
+	PROP_ANIMATE_SIZE,
 	PROP_LAST
 };
 
@@ -41,8 +78,14 @@ static void cmk_icon_get_property(GObject *self_, guint propertyId, GValue *valu
 static void get_preferred_width(ClutterActor *self_, gfloat forHeight, gfloat *minWidth, gfloat *natWidth);
 static void get_preferred_height(ClutterActor *self_, gfloat forWidth, gfloat *minHeight, gfloat *natHeight);
 static void on_styles_changed(CmkWidget *self_, guint flags);
+static gboolean get_paint_volume(ClutterActor *self_, ClutterPaintVolume *volume);
 static void on_default_icon_theme_changed(CmkIcon *self);
-static gboolean on_draw_canvas(ClutterCanvas *canvas, cairo_t *cr, int width, int height, CmkIcon *self);
+static void watch_loader(CmkIconLoader *loader);
+static void clear_animation(CmkIcon *self);
+static void queue_async_load(CmkIcon *self);
+static gboolean try_shared_texture(CmkIcon *self);
+static void clear_mips(CmkIcon *self);
+static gboolean animate_size_change(CmkIcon *self);
 
 G_DEFINE_TYPE_WITH_PRIVATE(CmkIcon, cmk_icon, CMK_TYPE_WIDGET);
 #define PRIVATE(icon) ((CmkIconPrivate *)cmk_icon_get_instance_private(icon))
@@ -70,49 +113,295 @@ CmkIcon * cmk_icon_new_full(const gchar *iconName, const gchar *themeName, gfloa
 		NULL));
 }
 
-static void queue_update_canvas(CmkIcon *self)
+static void queue_reload(CmkIcon *self)
 {
 	PRIVATE(self)->dirty = TRUE;
+	PRIVATE(self)->generation++;
 	clutter_actor_queue_redraw(CLUTTER_ACTOR(self));
 }
 
-static void on_paint(ClutterActor *self_)
+static guint get_icon_scale(CmkIcon *self)
 {
-	CmkIconPrivate *private = PRIVATE(CMK_ICON(self_));
+	return roundf(cmk_widget_get_dp_scale(CMK_WIDGET(self)));
+}
+
+/*
+ * Looks up an icon's path by name, or by content type if @iconName is
+ * %NULL, falling back to the missing image icon. Safe to call from any
+ * thread.
+ */
+static gchar * lookup_icon_path(CmkIconLoader *loader, const gchar *iconName, const gchar *contentType, const gchar *themeName, guint size, guint scale, gboolean mask)
+{
+	gchar *path;
+	if(iconName)
+		path = cmk_icon_loader_lookup_full(loader, iconName, TRUE, themeName, TRUE, size, scale);
+	else
+		path = cmk_icon_loader_lookup_content_type(loader, contentType, mask, themeName, size, scale);
+	if(!path)
+		path = cmk_icon_loader_lookup_full(loader, "gtk-missing-image", TRUE, themeName, TRUE, size, scale);
+	return path;
+}
+
+// Only the alpha is loaded when using the foreground color. Safe to call
+// from any thread.
+static cairo_surface_t * load_icon_surface(CmkIconLoader *loader, const gchar *path, guint size, guint scale, gboolean mask)
+{
+	if(mask)
+		return cmk_icon_loader_load_mask(loader, path, size, scale, TRUE);
+	return cmk_icon_loader_load(loader, path, size, scale, TRUE);
+}
+
+/*
+ * Looks up and loads an icon on the background thread. A file that is
+ * found but fails to load is shown as the missing image icon, as is one
+ * that isn't found. Returns %NULL, and sets *@path to %NULL, if even
+ * that can't be loaded.
+ */
+static cairo_surface_t * load_icon(CmkIconLoader *loader, const gchar *iconName, const gchar *contentType, const gchar *themeName, guint size, guint scale, gboolean mask, gchar **path)
+{
+	*path = lookup_icon_path(loader, iconName, contentType, themeName, size, scale, mask);
+	cairo_surface_t *surface = *path ? load_icon_surface(loader, *path, size, scale, mask) : NULL;
+	if(!surface && *path)
+	{
+		g_free(*path);
+		*path = cmk_icon_loader_lookup_full(loader, "gtk-missing-image", TRUE, themeName, TRUE, size, scale);
+		if(*path)
+			surface = load_icon_surface(loader, *path, size, scale, mask);
+	}
+	if(!surface)
+		g_clear_pointer(path, g_free);
+	return surface;
+}
+
+/*
+ * Gets the texture of an icon file, shared with every other icon showing
+ * the same file at the same pixel size. If no icon is showing it yet,
+ * @surface, the icon as loaded by the background thread, is uploaded.
+ * Never loads anything itself, so it is safe to use on the main thread.
+ */
+static CmkIconTexture * get_loaded_icon_texture(const gchar *path, guint pixelSize, gboolean mask, cairo_surface_t *surface)
+{
+	if(!path || !surface)
+		return NULL;
+	CmkIconTexture *texture = cmk_icon_texture_lookup(path, pixelSize, mask);
+	return texture ? texture : cmk_icon_texture_new(path, pixelSize, mask, surface);
+}
+
+/*
+ * Like get_loaded_icon_texture(), but loads the icon itself if no icon is
+ * showing it yet. Only for icons that load synchronously.
+ */
+static CmkIconTexture * get_icon_texture(CmkIconLoader *loader, const gchar *path, guint size, guint scale, gboolean mask)
+{
+	if(!path)
+		return NULL;
+	CmkIconTexture *texture = cmk_icon_texture_lookup(path, size*scale, mask);
+	if(texture)
+		return texture;
+
+	cairo_surface_t *surface = load_icon_surface(loader, path, size, scale, mask);
+	if(!surface)
+		return NULL;
+	texture = cmk_icon_texture_new(path, size*scale, mask, surface);
+	cairo_surface_destroy(surface);
+	return texture;
+}
+
+/*
+ * Replaces the drawn texture. Takes ownership of @texture.
+ */
+static void set_texture(CmkIcon *self, CmkIconTexture *texture)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	g_clear_pointer(&private->texture, cmk_icon_texture_unref);
+	private->texture = texture;
+	private->sizeChanging = FALSE;
+	if(private->pipeline)
+		cogl_pipeline_set_layer_texture(private->pipeline, 0, texture ? texture->texture : NULL);
+}
+
+/*
+ * Icons using the foreground color are drawn as the pipeline's color
+ * masked by the texture's alpha, so a color change (hover, insensitive,
+ * a new theme) only changes the color set on the pipeline at paint time.
+ * Nothing is rasterized or uploaded again. The pipelines are copies of
+ * one template per mode, so Cogl can share their generated programs.
+ */
+static CoglPipeline * new_icon_pipeline(gboolean tinted)
+{
+	static CoglPipeline *templates[2] = {NULL, NULL};
+	tinted = !!tinted;
+	if(!templates[tinted])
+	{
+		CoglContext *ctx = clutter_backend_get_cogl_context(clutter_get_default_backend());
+		templates[tinted] = cogl_pipeline_new(ctx);
+		if(tinted)
+			cogl_pipeline_set_layer_combine(templates[tinted], 0, "RGBA = MODULATE (PRIMARY, TEXTURE[A])", NULL);
+		cogl_pipeline_set_layer_filters(templates[tinted], 0, COGL_PIPELINE_FILTER_LINEAR, COGL_PIPELINE_FILTER_LINEAR);
+	}
+	return cogl_pipeline_copy(templates[tinted]);
+}
+
+/*
+ * Loads a named icon if anything changed since the last load. Also
+ * called from on_map, as on_paint isn't called for an icon added to an
+ * already mapped widget until something else queues a redraw. Unless the
+ * icon loads synchronously, this only queues the load, and any old
+ * texture stays up until the new one is ready.
+ */
+static void update_icon(CmkIcon *self)
+{
+	CmkIconPrivate *private = PRIVATE(self);
 	if(!private->dirty)
 		return;
 	private->dirty = FALSE;
+	private->loading = FALSE;
 	
-	gfloat fscale = cmk_widget_get_dp_scale(CMK_WIDGET(self_));
-	guint scale = roundf(fscale);
-	
-	if(!private->setPixmap)
+	if(!private->setPixmap && !private->loadSynchronously)
 	{
-		g_clear_pointer(&private->iconSurface, cairo_surface_destroy);
-		if(private->iconName)
+		if(!private->iconName && !private->contentType)
+			set_texture(self, NULL);
+		else if(!try_shared_texture(self))
 		{
-			gchar *path = cmk_icon_loader_lookup_full(private->loader, private->iconName, TRUE, private->themeName, TRUE, private->size, scale);
-			if(!path)
-				path = cmk_icon_loader_lookup_full(private->loader, "gtk-missing-image", TRUE, private->themeName, TRUE, private->size, scale);
-			
-			private->iconSurface = cmk_icon_loader_load(private->loader, path, private->size, scale, TRUE);
+			private->loading = TRUE;
+			queue_async_load(self);
+		}
+	}
+	else if(!private->setPixmap)
+	{
+		CmkIconTexture *texture = NULL;
+		if(private->iconName || private->contentType)
+		{
+			guint scale = get_icon_scale(self);
+			gchar *path = lookup_icon_path(private->loader, private->iconName, private->contentType, private->themeName, private->size, scale, private->useForegroundColor);
+			texture = get_icon_texture(private->loader, path, private->size, scale, private->useForegroundColor);
 			g_free(path);
 		}
+		set_texture(self, texture);
 	}
-	
-	ClutterCanvas *canvas = CLUTTER_CANVAS(clutter_actor_get_content(self_));
-	if(!clutter_canvas_set_size(canvas, private->size*scale, private->size*scale))
-		clutter_content_invalidate(CLUTTER_CONTENT(canvas));
+}
+
+/*
+ * Fills the icon's square with the placeholder color while the icon is
+ * loading, fading it out as the icon fades in.
+ */
+static void paint_placeholder(CmkIcon *self, gfloat x, gfloat y, gfloat side, gfloat fade)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	if(!private->placeholderColor || fade >= 1)
+		return;
+	const ClutterColor *c = cmk_widget_get_default_named_color(CMK_WIDGET(self), private->placeholderColor);
+
+	// Each icon keeps its own copy of the template, so painting only
+	// changes its color
+	static CoglPipeline *template = NULL;
+	if(!template)
+		template = cogl_pipeline_new(clutter_backend_get_cogl_context(clutter_get_default_backend()));
+	if(!private->placeholderPipeline)
+		private->placeholderPipeline = cogl_pipeline_copy(template);
+	guint8 opacity = clutter_actor_get_paint_opacity(CLUTTER_ACTOR(self));
+	CoglColor color;
+	cogl_color_init_from_4ub(&color, c->red, c->green, c->blue, c->alpha * opacity / 255 * (1 - fade));
+	cogl_color_premultiply(&color);
+	cogl_pipeline_set_color(private->placeholderPipeline, &color);
+	cogl_framebuffer_draw_rectangle(cogl_get_draw_framebuffer(), private->placeholderPipeline, x, y, x + side, y + side);
+	cmk_icon_texture_note_other_draw();
+}
+
+static void on_paint(ClutterActor *self_)
+{
+	CmkIcon *self = CMK_ICON(self_);
+	CmkIconPrivate *private = PRIVATE(self);
+	update_icon(self);
+
+	// Fit the texture into a square of the icon's size, centered in the
+	// allocation
+	gfloat width, height;
+	clutter_actor_get_size(self_, &width, &height);
+	gfloat side = private->size * cmk_widget_get_dp_scale(CMK_WIDGET(self));
+	if(side <= 0)
+		side = MIN(width, height);
+
+	gfloat fade = 1;
+	if(private->fadeIn && clutter_timeline_is_playing(private->fadeIn))
+		fade = clutter_timeline_get_progress(private->fadeIn);
+	if(private->loading || fade < 1)
+		paint_placeholder(self, roundf((width - side) / 2), roundf((height - side) / 2), side, private->texture ? fade : 0);
+
+	if(!private->texture)
+		return;
+
+	// While the size animates, draw the smallest mip at least as large as
+	// the icon on screen, so the GPU only ever scales it down a little
+	CmkIconTexture *tex = private->texture;
+	if(private->sizeChanging)
+	{
+		for(guint i=0;i<NUM_MIP_LEVELS;++i)
+		{
+			if(!private->mips[i])
+				continue;
+			tex = private->mips[i];
+			if(MIP_LEVEL_SIZE(i) >= side)
+				break;
+		}
+	}
+
+	if(!private->pipeline)
+		private->pipeline = new_icon_pipeline(private->useForegroundColor);
+	cogl_pipeline_set_layer_texture(private->pipeline, 0, tex->texture);
+
+	guint8 opacity = clutter_actor_get_paint_opacity(self_) * fade;
+	if(private->useForegroundColor)
+	{
+		const ClutterColor *fg = cmk_widget_get_default_named_color(CMK_WIDGET(self), "foreground");
+		CoglColor color;
+		cogl_color_init_from_4ub(&color, fg->red, fg->green, fg->blue, fg->alpha * opacity / 255);
+		cogl_color_premultiply(&color);
+		cogl_pipeline_set_color(private->pipeline, &color);
+	}
+	else
+		cogl_pipeline_set_color4ub(private->pipeline, opacity, opacity, opacity, opacity);
+
+	gfloat texW = tex->width;
+	gfloat texH = tex->height;
+	gfloat factor = side / MAX(texW, texH);
+	gfloat w = texW * factor, h = texH * factor;
+	gfloat x = roundf((width - w) / 2), y = roundf((height - h) / 2);
+
+	gfloat s1 = tex->s1, t1 = tex->t1;
+	if(private->numFrames > 1)
+	{
+		s1 += (private->frame % private->framesPerRow) * private->frameStepS;
+		t1 += (private->frame / private->framesPerRow) * private->frameStepT;
+	}
+
+	cmk_icon_texture_note_draw(tex);
+	cogl_framebuffer_draw_textured_rectangle(cogl_get_draw_framebuffer(),
+		private->pipeline,
+		x, y, x + w, y + h,
+		s1, t1,
+		s1 + (tex->s2 - tex->s1), t1 + (tex->t2 - tex->t1));
+}
+
+static gboolean get_paint_volume(ClutterActor *self_, ClutterPaintVolume *volume)
+{
+	return clutter_paint_volume_set_from_allocation(volume, self_);
 }
 
 static void on_map(ClutterActor *self_)
 {
 	CLUTTER_ACTOR_CLASS(cmk_icon_parent_class)->map(self_);
-	// When adding an icon to an already mapped widget, on_paint doesn't
-	// get called for some reason. TODO: Not sure why. But just calling
-	// paint in the on_map works (only if on_paint doesn't chain up, which
-	// it doesn't here).
-	on_paint(self_);
+	update_icon(CMK_ICON(self_));
+	if(PRIVATE(CMK_ICON(self_))->animation)
+		clutter_timeline_start(PRIVATE(CMK_ICON(self_))->animation);
+}
+
+static void on_unmap(ClutterActor *self_)
+{
+	// Animations don't need to tick while nothing can see them
+	if(PRIVATE(CMK_ICON(self_))->animation)
+		clutter_timeline_pause(PRIVATE(CMK_ICON(self_))->animation);
+	CLUTTER_ACTOR_CLASS(cmk_icon_parent_class)->unmap(self_);
 }
 
 static void cmk_icon_class_init(CmkIconClass *class)
@@ -126,45 +415,53 @@ static void cmk_icon_class_init(CmkIconClass *class)
 	actorClass->get_preferred_width = get_preferred_width;
 	actorClass->get_preferred_height = get_preferred_height;
 	actorClass->paint = on_paint;
+	actorClass->get_paint_volume = get_paint_volume;
 	actorClass->map = on_map;
+	actorClass->unmap = on_unmap;
 	
 	CMK_WIDGET_CLASS(class)->styles_changed = on_styles_changed;
 
 	properties[PROP_ICON_NAME] = g_param_spec_string("icon-name", "icon-name", "Icon name", NULL, G_PARAM_READWRITE);
+	properties[PROP_CONTENT_TYPE] = g_param_spec_string("content-type", "content-type", "Content type to show the icon of", NULL, G_PARAM_READWRITE);
 	properties[PROP_ICON_THEME] = g_param_spec_string("icon-theme", "icon-theme", "Icon theme name", NULL, G_PARAM_READWRITE);
 	properties[PROP_ICON_SIZE] = g_param_spec_float("icon-size", "icon-size", "Icon size reqest", 0, 1024, 0, G_PARAM_READWRITE);
 	properties[PROP_USE_FOREGROUND_COLOR] = g_param_spec_boolean("use-foreground-color", "use foreground color", "use foreground color to color the icon", FALSE, G_PARAM_READWRITE);
+	properties[PROP_LOAD_SYNCHRONOUSLY] = g_param_spec_boolean("load-synchronously", "load synchronously", "Load the icon during paint instead of in the background", FALSE, G_PARAM_READWRITE);
+	properties[PROP_PLACEHOLDER_COLOR] = g_param_spec_string("placeholder-color", "placeholder color", "Named color to fill the icon with while it loads", NULL, G_PARAM_READWRITE);
+	properties[PROP_ANIMATE_SIZE] = g_param_spec_boolean("animate-size", "animate size", "Scale pre-sized images while the icon size changes instead of reloading", FALSE, G_PARAM_READWRITE);
 
 	g_object_class_install_properties(base, PROP_LAST, properties);
 }
 
 static void cmk_icon_init(CmkIcon *self)
 {
-	ClutterContent *canvas = clutter_canvas_new();
-
-	// Commit 20fcb8863293 of Mutter removed scale-factor from their
-	// internal version of Clutter, as it was unnecessary. So when
-	// clutter_canvas_set_scale_factor is called from Graphene, it
-	// spews critical errors to stdout because there's no scale-factor
-	// property. clutter_canvas_set_scale_factor isn't a function in
-	// mutter-clutter either, but it links to cmk-clutter's version.
-	if(g_object_class_find_property(G_OBJECT_GET_CLASS(G_OBJECT(self)), "scale-factor") != NULL)
-		clutter_canvas_set_scale_factor(CLUTTER_CANVAS(canvas), 1); // Manual scaling
-
-	g_signal_connect(canvas, "draw", G_CALLBACK(on_draw_canvas), self);
-	clutter_actor_set_content_gravity(CLUTTER_ACTOR(self), CLUTTER_CONTENT_GRAVITY_CENTER);
-	clutter_actor_set_content(CLUTTER_ACTOR(self), canvas);
-	
 	PRIVATE(self)->loader = cmk_icon_loader_get_default();
+	watch_loader(PRIVATE(self)->loader);
 	g_signal_connect_swapped(PRIVATE(self)->loader, "notify::default-theme", G_CALLBACK(on_default_icon_theme_changed), self);
 }
 
 static void cmk_icon_dispose(GObject *self_)
 {
 	CmkIconPrivate *private = PRIVATE(CMK_ICON(self_));
+	if(private->loader)
+		g_signal_handlers_disconnect_by_data(private->loader, self_);
 	g_clear_object(&private->loader);
-	g_clear_pointer(&private->iconSurface, cairo_surface_destroy);
+	clear_animation(CMK_ICON(self_));
+	if(private->fadeIn)
+	{
+		clutter_timeline_stop(private->fadeIn);
+		g_clear_object(&private->fadeIn);
+	}
+	g_clear_pointer(&private->placeholderColor, g_free);
+	if(private->settleSource)
+		g_source_remove(private->settleSource);
+	private->settleSource = 0;
+	clear_mips(CMK_ICON(self_));
+	g_clear_pointer(&private->texture, cmk_icon_texture_unref);
+	g_clear_pointer(&private->pipeline, cogl_object_unref);
+	g_clear_pointer(&private->placeholderPipeline, cogl_object_unref);
 	g_clear_pointer(&private->iconName, g_free);
+	g_clear_pointer(&private->contentType, g_free);
 	g_clear_pointer(&private->themeName, g_free);
 	G_OBJECT_CLASS(cmk_icon_parent_class)->dispose(self_);
 }
@@ -179,6 +476,9 @@ static void cmk_icon_set_property(GObject *self_, guint propertyId, const GValue
 	case PROP_ICON_NAME:
 		cmk_icon_set_icon(self, g_value_get_string(value));
 		break;
+	case PROP_CONTENT_TYPE:
+		cmk_icon_set_from_content_type(self, g_value_get_string(value));
+		break;
 	case PROP_ICON_THEME:
 		cmk_icon_set_icon_theme(self, g_value_get_string(value));
 		break;
@@ -188,6 +488,15 @@ static void cmk_icon_set_property(GObject *self_, guint propertyId, const GValue
 	case PROP_USE_FOREGROUND_COLOR:
 		cmk_icon_set_use_foreground_color(self, g_value_get_boolean(value));
 		break;
+	case PROP_LOAD_SYNCHRONOUSLY:
+		cmk_icon_set_load_synchronously(self, g_value_get_boolean(value));
+		break;
+	case PROP_PLACEHOLDER_COLOR:
+		cmk_icon_set_placeholder_color(self, g_value_get_string(value));
+		break;
+	case PROP_ANIMATE_SIZE:
+		cmk_icon_set_animate_size(self, g_value_get_boolean(value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(self, propertyId, pspec);
 		break;
@@ -204,6 +513,9 @@ static void cmk_icon_get_property(GObject *self_, guint propertyId, GValue *valu
 	case PROP_ICON_NAME:
 		g_value_set_string(value, cmk_icon_get_icon(self));
 		break;
+	case PROP_CONTENT_TYPE:
+		g_value_set_string(value, cmk_icon_get_content_type(self));
+		break;
 	case PROP_ICON_THEME:
 		g_value_set_string(value, cmk_icon_get_icon_theme(self));
 		break;
@@ -213,6 +525,15 @@ static void cmk_icon_get_property(GObject *self_, guint propertyId, GValue *valu
 	case PROP_USE_FOREGROUND_COLOR:
 		g_value_set_boolean(value, cmk_icon_get_use_foreground_color(self));
 		break;
+	case PROP_LOAD_SYNCHRONOUSLY:
+		g_value_set_boolean(value, cmk_icon_get_load_synchronously(self));
+		break;
+	case PROP_PLACEHOLDER_COLOR:
+		g_value_set_string(value, cmk_icon_get_placeholder_color(self));
+		break;
+	case PROP_ANIMATE_SIZE:
+		g_value_set_boolean(value, cmk_icon_get_animate_size(self));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(self, propertyId, pspec);
 		break;
@@ -234,50 +555,315 @@ static void get_preferred_height(ClutterActor *self_, UNUSED gfloat forWidth, gf
 static void on_styles_changed(CmkWidget *self_, guint flags)
 {
 	CMK_WIDGET_CLASS(cmk_icon_parent_class)->styles_changed(self_, flags);
-	if((flags & CMK_STYLE_FLAG_COLORS)
-	|| (flags & CMK_STYLE_FLAG_DP))
-		queue_update_canvas(CMK_ICON(self_));
+	if((flags & CMK_STYLE_FLAG_DP) && !animate_size_change(CMK_ICON(self_)))
+		queue_reload(CMK_ICON(self_));
+	else if(flags & CMK_STYLE_FLAG_COLORS)
+		clutter_actor_queue_redraw(CLUTTER_ACTOR(self_));
 }
 
-static void on_default_icon_theme_changed(CmkIcon *self)
+/*
+ * Named icons are looked up and loaded on a background thread, so that
+ * an icon that has to hit the disk never holds up a frame. Icons that
+ * need loading are collected until the main loop is idle and then loaded
+ * together, mapped icons first. Results are applied in small chunks as
+ * they come in, so the icons on screen appear first.
+ *
+ * The same queue handles default icon theme changes: every icon using
+ * the default theme is reloaded, and keeps drawing its old texture until
+ * the new one is ready. It also loads the mip levels of icons with
+ * animate-size set, in the same job as the icon itself if both are due.
+ */
+#define LOAD_CHUNK_SIZE 8
+#define MAX_RESOLVED_PATHS 512
+#define FADE_IN_DURATION 150
+
+typedef struct
+{
+	CmkIcon *icon;
+	guint generation;
+	CmkIconLoader *loader;
+	gchar *iconName;
+	gchar *contentType;
+	gchar *themeName;
+	guint size;
+	guint scale;
+	gboolean mask;
+	gboolean exact; // Load the icon at size
+	gchar *path;
+	cairo_surface_t *surface;
+
+	gboolean mips; // Load the mip levels
+	guint mipGeneration;
+	gchar *mipPaths[NUM_MIP_LEVELS];
+	cairo_surface_t *mipSurfaces[NUM_MIP_LEVELS];
+} LoadJob;
+
+static GPtrArray *pendingLoads = NULL; // CmkIcon *, with a ref held
+static guint pendingLoadSource = 0;
+
+// Paths of icons loaded before, so an icon whose texture is already in
+// use by another icon can be shown at once. Key: resolved_path_key()
+// Emptied whenever the loader's icons change, and once it holds
+// MAX_RESOLVED_PATHS, as icons of every size an animated icon passes
+// through would otherwise pile up here.
+static GHashTable *resolvedPaths = NULL;
+
+static gchar * resolved_path_key(const gchar *iconName, const gchar *contentType, const gchar *themeName, guint size, guint scale, gboolean mask)
 {
-	if(PRIVATE(self)->themeName == NULL)
-		queue_update_canvas(self);
+	return g_strdup_printf("%u@%u:%s:%s:%s:%s", size, scale, mask ? "a8" : "",
+		themeName ? themeName : "",
+		iconName ? "" : "type",
+		iconName ? iconName : contentType);
 }
 
-static gboolean on_draw_canvas(UNUSED ClutterCanvas *canvas, cairo_t *cr, UNUSED int width, int height, CmkIcon *self)
+static void free_load_job(LoadJob *job)
 {
-	cairo_save(cr);
-	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-	cairo_paint(cr);
-	cairo_restore(cr);
-	
-	if(PRIVATE(self)->iconSurface)
+	g_object_unref(job->icon);
+	g_object_unref(job->loader);
+	g_free(job->iconName);
+	g_free(job->contentType);
+	g_free(job->themeName);
+	g_free(job->path);
+	if(job->surface)
+		cairo_surface_destroy(job->surface);
+	for(guint i=0;i<NUM_MIP_LEVELS;++i)
 	{
-		gdouble factor = (gdouble)height / cairo_image_surface_get_height(PRIVATE(self)->iconSurface);
-		cairo_scale(cr, factor, factor);
-		if(PRIVATE(self)->useForegroundColor)
+		g_free(job->mipPaths[i]);
+		if(job->mipSurfaces[i])
+			cairo_surface_destroy(job->mipSurfaces[i]);
+	}
+	g_free(job);
+}
+
+static void start_fade_in(CmkIcon *self)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	if(!private->fadeIn)
+	{
+		private->fadeIn = clutter_timeline_new(FADE_IN_DURATION);
+		clutter_timeline_set_progress_mode(private->fadeIn, CLUTTER_EASE_OUT_QUAD);
+		g_signal_connect_swapped(private->fadeIn, "new-frame", G_CALLBACK(clutter_actor_queue_redraw), self);
+	}
+	clutter_timeline_rewind(private->fadeIn);
+	clutter_timeline_start(private->fadeIn);
+}
+
+static gboolean apply_loads(GPtrArray *chunk)
+{
+	for(guint i=0;i<chunk->len;++i)
+	{
+		LoadJob *job = g_ptr_array_index(chunk, i);
+		CmkIconPrivate *private = PRIVATE(job->icon);
+		if(!private->loader)
+			continue;
+
+		if(job->mips && private->mipGeneration == job->mipGeneration)
 		{
-			cairo_set_source_clutter_color(cr,
-				cmk_widget_get_default_named_color(CMK_WIDGET(self), "foreground"));
-			cairo_mask_surface(cr, PRIVATE(self)->iconSurface, 0, 0);
+			private->mipsPending = FALSE;
+			for(guint j=0;j<NUM_MIP_LEVELS;++j)
+			{
+				g_clear_pointer(&private->mips[j], cmk_icon_texture_unref);
+				private->mips[j] = get_loaded_icon_texture(job->mipPaths[j], MIP_LEVEL_SIZE(j), job->mask, job->mipSurfaces[j]);
+			}
+			if(private->sizeChanging)
+				clutter_actor_queue_redraw(CLUTTER_ACTOR(job->icon));
 		}
-		else
+
+		if(!job->exact || private->generation != job->generation || private->dirty)
+			continue;
+
+		if(job->path)
+		{
+			if(!resolvedPaths)
+				resolvedPaths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+			else if(g_hash_table_size(resolvedPaths) >= MAX_RESOLVED_PATHS)
+				g_hash_table_remove_all(resolvedPaths);
+			g_hash_table_insert(resolvedPaths,
+				resolved_path_key(job->iconName, job->contentType, job->themeName, job->size, job->scale, job->mask),
+				g_strdup(job->path));
+		}
+
+		// Icons that had nothing to show fade in; icons replacing an old
+		// texture (after a theme change) just switch
+		gboolean wasEmpty = (private->texture == NULL);
+		private->loading = FALSE;
+		set_texture(job->icon, get_loaded_icon_texture(job->path, job->size*job->scale, job->mask, job->surface));
+		if(wasEmpty && private->texture && clutter_actor_is_mapped(CLUTTER_ACTOR(job->icon)))
+			start_fade_in(job->icon);
+		clutter_actor_queue_redraw(CLUTTER_ACTOR(job->icon));
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void load_thread(GTask *task, UNUSED gpointer source, GPtrArray *jobs, UNUSED GCancellable *cancellable)
+{
+	GMainContext *context = g_task_get_context(task);
+	GPtrArray *chunk = NULL;
+	for(guint i=0;i<jobs->len;++i)
+	{
+		LoadJob *job = g_ptr_array_index(jobs, i);
+		if(job->exact)
+			job->surface = load_icon(job->loader, job->iconName, job->contentType, job->themeName, job->size, job->scale, job->mask, &job->path);
+		for(guint j=0;job->mips && j<NUM_MIP_LEVELS;++j)
+			job->mipSurfaces[j] = load_icon(job->loader, job->iconName, job->contentType, job->themeName, MIP_LEVEL_SIZE(j), 1, job->mask, &job->mipPaths[j]);
+
+		// The chunk takes ownership of its jobs
+		if(!chunk)
+			chunk = g_ptr_array_new_with_free_func((GDestroyNotify)free_load_job);
+		g_ptr_array_add(chunk, job);
+		if(chunk->len == LOAD_CHUNK_SIZE || i == jobs->len-1)
 		{
-			cairo_set_source_surface(cr, PRIVATE(self)->iconSurface, 0, 0);
-			cairo_paint(cr);
+			g_main_context_invoke_full(context, G_PRIORITY_DEFAULT, (GSourceFunc)apply_loads, chunk, (GDestroyNotify)g_ptr_array_unref);
+			chunk = NULL;
 		}
 	}
+	g_task_return_boolean(task, TRUE);
+}
+
+static gint compare_load_priority(CmkIcon **a, CmkIcon **b)
+{
+	gboolean mappedA = clutter_actor_is_mapped(CLUTTER_ACTOR(*a));
+	gboolean mappedB = clutter_actor_is_mapped(CLUTTER_ACTOR(*b));
+	return mappedB - mappedA;
+}
+
+static gboolean start_pending_loads(UNUSED gpointer userdata)
+{
+	pendingLoadSource = 0;
+	GPtrArray *icons = pendingLoads;
+	pendingLoads = NULL;
+	g_ptr_array_sort(icons, (GCompareFunc)compare_load_priority);
+
+	GPtrArray *jobs = g_ptr_array_new();
+	for(guint i=0;i<icons->len;++i)
+	{
+		CmkIcon *icon = g_ptr_array_index(icons, i);
+		CmkIconPrivate *private = PRIVATE(icon);
+		private->queued = FALSE;
+		if(private->setPixmap || (!private->iconName && !private->contentType) || !private->loader)
+			continue;
+		gboolean exact = private->loading && !private->dirty;
+		if(!exact && !private->mipsPending)
+			continue;
+
+		LoadJob *job = g_new0(LoadJob, 1);
+		job->icon = g_object_ref(icon);
+		job->generation = private->generation;
+		job->loader = g_object_ref(private->loader);
+		job->iconName = g_strdup(private->iconName);
+		job->contentType = g_strdup(private->contentType);
+		job->themeName = g_strdup(private->themeName);
+		job->size = private->size;
+		job->scale = get_icon_scale(icon);
+		job->mask = private->useForegroundColor;
+		job->exact = exact;
+		job->mips = private->mipsPending;
+		job->mipGeneration = private->mipGeneration;
+		g_ptr_array_add(jobs, job);
+	}
+	g_ptr_array_unref(icons);
+
+	if(jobs->len == 0)
+	{
+		g_ptr_array_unref(jobs);
+		return G_SOURCE_REMOVE;
+	}
+
+	GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+	g_task_set_task_data(task, jobs, (GDestroyNotify)g_ptr_array_unref);
+	g_task_run_in_thread(task, (GTaskThreadFunc)load_thread);
+	g_object_unref(task);
+	return G_SOURCE_REMOVE;
+}
+
+static void queue_async_load(CmkIcon *self)
+{
+	if(PRIVATE(self)->queued)
+		return;
+	PRIVATE(self)->queued = TRUE;
+	if(!pendingLoads)
+		pendingLoads = g_ptr_array_new_with_free_func(g_object_unref);
+	g_ptr_array_add(pendingLoads, g_object_ref(self));
+	if(!pendingLoadSource)
+		pendingLoadSource = g_idle_add(start_pending_loads, NULL);
+}
+
+/*
+ * Shows an icon without going through the background thread, if the
+ * same icon has been loaded before and its texture is still in use.
+ */
+static gboolean try_shared_texture(CmkIcon *self)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	if(!resolvedPaths)
+		return FALSE;
+	guint scale = get_icon_scale(self);
+	gchar *key = resolved_path_key(private->iconName, private->contentType, private->themeName, private->size, scale, private->useForegroundColor);
+	const gchar *path = g_hash_table_lookup(resolvedPaths, key);
+	g_free(key);
+	CmkIconTexture *texture = path ? cmk_icon_texture_lookup(path, private->size*scale, private->useForegroundColor) : NULL;
+	if(!texture)
+		return FALSE;
+	set_texture(self, texture);
 	return TRUE;
 }
 
+static void on_icons_changed(UNUSED CmkIconLoader *loader, UNUSED gpointer userdata)
+{
+	if(resolvedPaths)
+		g_hash_table_remove_all(resolvedPaths);
+}
+
+/*
+ * Forgets resolvedPaths whenever names may resolve differently, once per
+ * change rather than once per icon. Icons all use the default loader, but
+ * it is replaced if every icon lets go of it.
+ */
+static void watch_loader(CmkIconLoader *loader)
+{
+	static CmkIconLoader *watched = NULL;
+	if(loader == watched)
+		return;
+	if(watched)
+		g_object_remove_weak_pointer(G_OBJECT(watched), (gpointer *)&watched);
+	watched = loader;
+	g_object_add_weak_pointer(G_OBJECT(watched), (gpointer *)&watched);
+	g_signal_connect(watched, "icons-changed", G_CALLBACK(on_icons_changed), NULL);
+}
+
+static void on_default_icon_theme_changed(CmkIcon *self)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	if(private->themeName != NULL || private->setPixmap || (!private->iconName && !private->contentType))
+		return;
+
+	// Icons waiting for their first paint will load from the new theme
+	// anyway
+	if(private->dirty)
+		return;
+
+	// Any load already in flight is for the old theme
+	clear_mips(self);
+	private->generation++;
+	if(private->loadSynchronously)
+		queue_reload(self);
+	else
+	{
+		private->loading = TRUE;
+		queue_async_load(self);
+	}
+}
+
 void cmk_icon_set_icon(CmkIcon *self, const gchar *iconName)
 {
 	g_return_if_fail(CMK_IS_ICON(self));
 	g_free(PRIVATE(self)->iconName);
 	PRIVATE(self)->iconName = g_strdup(iconName);
+	g_clear_pointer(&PRIVATE(self)->contentType, g_free);
 	PRIVATE(self)->setPixmap = FALSE;
-	queue_update_canvas(self);
+	clear_animation(self);
+	clear_mips(self);
+	queue_reload(self);
 }
 
 const gchar * cmk_icon_get_icon(CmkIcon *self)
@@ -288,19 +874,208 @@ const gchar * cmk_icon_get_icon(CmkIcon *self)
 	return PRIVATE(self)->iconName;
 }
 
-// TODO: Animated
-void cmk_icon_set_pixmap(CmkIcon *self, guchar *data, cairo_format_t format, guint size, UNUSED guint frames, UNUSED guint fps)
+void cmk_icon_set_from_content_type(CmkIcon *self, const gchar *contentType)
+{
+	g_return_if_fail(CMK_IS_ICON(self));
+	g_free(PRIVATE(self)->contentType);
+	PRIVATE(self)->contentType = g_strdup(contentType);
+	g_clear_pointer(&PRIVATE(self)->iconName, g_free);
+	PRIVATE(self)->setPixmap = FALSE;
+	clear_animation(self);
+	clear_mips(self);
+	queue_reload(self);
+}
+
+const gchar * cmk_icon_get_content_type(CmkIcon *self)
+{
+	g_return_val_if_fail(CMK_IS_ICON(self), NULL);
+	if(PRIVATE(self)->setPixmap)
+		return NULL;
+	return PRIVATE(self)->contentType;
+}
+
+static void clear_animation(CmkIcon *self)
 {
 	CmkIconPrivate *private = PRIVATE(self);
+	if(private->animation)
+	{
+		clutter_timeline_stop(private->animation);
+		g_clear_object(&private->animation);
+	}
+	private->numFrames = 0;
+	private->frame = 0;
+}
+
+static void on_animation_frame(CmkIcon *self, UNUSED gint msecs, ClutterTimeline *timeline)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	guint duration = clutter_timeline_get_duration(timeline);
+	guint frame = (guint64)clutter_timeline_get_elapsed_time(timeline) * private->numFrames / MAX(duration, 1);
+	frame = MIN(frame, private->numFrames - 1);
+	if(frame != private->frame)
+	{
+		private->frame = frame;
+		clutter_actor_queue_redraw(CLUTTER_ACTOR(self));
+	}
+}
+
+static void set_pixmap_data(CmkIcon *self, const guchar *data, cairo_format_t format, guint size, guint frames, guint fps)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	
+	// Without a frame rate only the first frame is ever shown
+	frames = (fps > 0) ? MAX(frames, 1) : 1;
+
+	// A still pixmap replacing one of the same size and format (a tray
+	// icon updating, say) is written over the old texture instead of
+	// allocating a new one. The old texture must hold exactly one image,
+	// not a padded grid of frames.
+	CmkIconTexture *tex = private->texture;
+	if(frames == 1 && private->setPixmap && private->numFrames <= 1 && tex
+	&& tex->width == size && tex->height == size
+	&& tex->s1 == 0 && tex->t1 == 0 && tex->s2 == 1 && tex->t2 == 1
+	&& (cogl_texture_get_components(tex->texture) == COGL_TEXTURE_COMPONENTS_A) == (format == CAIRO_FORMAT_A8)
+	&& cogl_texture_set_region(tex->texture,
+		0, 0, 0, 0, size, size, size, size,
+		(format == CAIRO_FORMAT_A8) ? COGL_PIXEL_FORMAT_A_8 : CLUTTER_CAIRO_FORMAT_ARGB32,
+		cairo_format_stride_for_width(format, size),
+		data))
+	{
+		clutter_actor_queue_redraw(CLUTTER_ACTOR(self));
+		return;
+	}
+
+	clear_animation(self);
+	clear_mips(self);
+
+	// Pixmaps aren't shared, so the caller's data is uploaded as-is. Every
+	// frame goes into one texture up front, so playing the animation
+	// never rasterizes or uploads anything. If the frames don't fit in a
+	// texture, the first one is shown still.
+	guint framesPerRow = 1;
+	gfloat stepS = 0, stepT = 0;
+	CmkIconTexture *texture = cmk_icon_texture_new_frames(data, format, size, frames, &framesPerRow, &stepS, &stepT);
+	if(!texture && frames > 1)
+	{
+		frames = 1;
+		texture = cmk_icon_texture_new_frames(data, format, size, 1, NULL, NULL, NULL);
+	}
+	set_texture(self, texture);
 	
-	g_clear_pointer(&private->iconSurface, cairo_surface_destroy);
-	private->iconSurface = cairo_image_surface_create(format, size, size);
-	guchar *surfData = cairo_image_surface_get_data(private->iconSurface);
-	memcpy(surfData, data, size*cairo_format_stride_for_width(format, size));
-	cairo_surface_mark_dirty(private->iconSurface);
+	if(frames > 1 && fps > 0 && private->texture)
+	{
+		private->numFrames = frames;
+		private->framesPerRow = framesPerRow;
+		private->frameStepS = stepS;
+		private->frameStepT = stepT;
+		private->animation = clutter_timeline_new(MAX(frames * 1000 / fps, 1));
+		clutter_timeline_set_repeat_count(private->animation, -1);
+		g_signal_connect_swapped(private->animation, "new-frame", G_CALLBACK(on_animation_frame), self);
+		if(clutter_actor_is_mapped(CLUTTER_ACTOR(self)))
+			clutter_timeline_start(private->animation);
+	}
 	
 	private->setPixmap = TRUE;
-	queue_update_canvas(self);
+	private->loading = FALSE;
+	queue_reload(self);
+}
+
+void cmk_icon_set_pixmap(CmkIcon *self, guchar *data, cairo_format_t format, guint size, guint frames, guint fps)
+{
+	g_return_if_fail(CMK_IS_ICON(self));
+	g_return_if_fail(data != NULL);
+	set_pixmap_data(self, data, format, size, frames, fps);
+}
+
+void cmk_icon_set_pixmap_full(CmkIcon *self, const guchar *data, GDestroyNotify destroy, CmkPixmapFormat format, guint size, guint frames, guint fps)
+{
+	g_return_if_fail(CMK_IS_ICON(self));
+	g_return_if_fail(data != NULL);
+	frames = (fps > 0) ? MAX(frames, 1) : 1;
+
+	switch(format)
+	{
+	case CMK_PIXMAP_FORMAT_ARGB32:
+		set_pixmap_data(self, data, CAIRO_FORMAT_ARGB32, size, frames, fps);
+		break;
+	case CMK_PIXMAP_FORMAT_A8:
+		set_pixmap_data(self, data, CAIRO_FORMAT_A8, size, frames, fps);
+		break;
+	case CMK_PIXMAP_FORMAT_RGBA:
+	{
+		// GL can't premultiply on upload, so it's done here once, with SIMD
+		gsize numPixels = (gsize)size * size * frames;
+		guint32 *premultiplied = g_new(guint32, numPixels);
+		cmk_raster_premultiply_rgba(data, premultiplied, numPixels);
+		set_pixmap_data(self, (const guchar *)premultiplied, CAIRO_FORMAT_ARGB32, size, frames, fps);
+		g_free(premultiplied);
+		break;
+	}
+	default:
+		g_warn_if_reached();
+		break;
+	}
+
+	if(destroy)
+		destroy((gpointer)data);
+}
+
+void cmk_icon_set_pixmap_bytes(CmkIcon *self, GBytes *bytes, CmkPixmapFormat format, guint size, guint frames, guint fps)
+{
+	g_return_if_fail(CMK_IS_ICON(self));
+	g_return_if_fail(bytes != NULL);
+
+	gsize bpp = (format == CMK_PIXMAP_FORMAT_A8) ? 1 : 4;
+	gsize stride = (format == CMK_PIXMAP_FORMAT_A8) ? (gsize)cairo_format_stride_for_width(CAIRO_FORMAT_A8, size) : size * bpp;
+	gsize length;
+	const guchar *data = g_bytes_get_data(bytes, &length);
+	g_return_if_fail(length >= stride * size * MAX(frames, 1));
+	cmk_icon_set_pixmap_full(self, data, NULL, format, size, frames, fps);
+}
+
+static void clear_mips(CmkIcon *self)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	for(guint i=0;i<NUM_MIP_LEVELS;++i)
+		g_clear_pointer(&private->mips[i], cmk_icon_texture_unref);
+	private->mipsPending = FALSE;
+	private->mipGeneration++;
+}
+
+static gboolean on_size_settled(CmkIcon *self)
+{
+	PRIVATE(self)->settleSource = 0;
+	queue_reload(self);
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * With animate-size on, a size change only rescales what is already
+ * there, drawn from the nearest mip level, and the icon is loaded at its
+ * exact size once the size stops changing. The mips are loaded in the
+ * background on the first change.
+ */
+static gboolean animate_size_change(CmkIcon *self)
+{
+	CmkIconPrivate *private = PRIVATE(self);
+	if(!private->animateSize || private->setPixmap || !private->texture || private->dirty)
+		return FALSE;
+
+	// Loads for the old size are stale
+	private->generation++;
+	private->loading = FALSE;
+	private->sizeChanging = TRUE;
+	if(!private->mips[0] && !private->mipsPending)
+	{
+		private->mipsPending = TRUE;
+		queue_async_load(self);
+	}
+
+	if(private->settleSource)
+		g_source_remove(private->settleSource);
+	private->settleSource = g_timeout_add(SIZE_SETTLE_DELAY, (GSourceFunc)on_size_settled, self);
+	clutter_actor_queue_redraw(CLUTTER_ACTOR(self));
+	return TRUE;
 }
 
 void cmk_icon_set_size(CmkIcon *self, gfloat size)
@@ -311,7 +1086,8 @@ void cmk_icon_set_size(CmkIcon *self, gfloat size)
 		if(size <= 0)
 			size = 0;
 		PRIVATE(self)->size = size;
-		queue_update_canvas(self);
+		if(!animate_size_change(self))
+			queue_reload(self);
 		clutter_actor_queue_relayout(CLUTTER_ACTOR(self));
 	}
 }
@@ -328,7 +1104,9 @@ void cmk_icon_set_use_foreground_color(CmkIcon *self, gboolean useForeground)
 	if(PRIVATE(self)->useForegroundColor != useForeground)
 	{
 		PRIVATE(self)->useForegroundColor = useForeground;
-		queue_update_canvas(self);
+		g_clear_pointer(&PRIVATE(self)->pipeline, cogl_object_unref);
+		clear_mips(self);
+		queue_reload(self);
 	}
 }
 
@@ -343,7 +1121,8 @@ void cmk_icon_set_icon_theme(CmkIcon *self, const gchar *themeName)
 	g_return_if_fail(CMK_IS_ICON(self));
 	g_free(PRIVATE(self)->themeName);
 	PRIVATE(self)->themeName = g_strdup(themeName);
-	queue_update_canvas(self);
+	clear_mips(self);
+	queue_reload(self);
 }
 
 const gchar * cmk_icon_get_icon_theme(CmkIcon *self)
@@ -351,3 +1130,54 @@ const gchar * cmk_icon_get_icon_theme(CmkIcon *self)
 	g_return_val_if_fail(CMK_IS_ICON(self), NULL);
 	return PRIVATE(self)->themeName;
 }
+
+void cmk_icon_set_load_synchronously(CmkIcon *self, gboolean sync)
+{
+	g_return_if_fail(CMK_IS_ICON(self));
+	PRIVATE(self)->loadSynchronously = sync;
+}
+
+gboolean cmk_icon_get_load_synchronously(CmkIcon *self)
+{
+	g_return_val_if_fail(CMK_IS_ICON(self), FALSE);
+	return PRIVATE(self)->loadSynchronously;
+}
+
+void cmk_icon_set_placeholder_color(CmkIcon *self, const gchar *namedColor)
+{
+	g_return_if_fail(CMK_IS_ICON(self));
+	g_free(PRIVATE(self)->placeholderColor);
+	PRIVATE(self)->placeholderColor = g_strdup(namedColor);
+	clutter_actor_queue_redraw(CLUTTER_ACTOR(self));
+}
+
+const gchar * cmk_icon_get_placeholder_color(CmkIcon *self)
+{
+	g_return_val_if_fail(CMK_IS_ICON(self), NULL);
+	return PRIVATE(self)->placeholderColor;
+}
+
+void cmk_icon_set_animate_size(CmkIcon *self, gboolean animate)
+{
+	g_return_if_fail(CMK_IS_ICON(self));
+	CmkIconPrivate *private = PRIVATE(self);
+	if(private->animateSize == animate)
+		return;
+	private->animateSize = animate;
+	if(!animate)
+	{
+		if(private->settleSource)
+		{
+			g_source_remove(private->settleSource);
+			private->settleSource = 0;
+			queue_reload(self);
+		}
+		clear_mips(self);
+	}
+}
+
+gboolean cmk_icon_get_animate_size(CmkIcon *self)
+{
+	g_return_val_if_fail(CMK_IS_ICON(self), FALSE);
+	return PRIVATE(self)->animateSize;
+}
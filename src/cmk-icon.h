@@ -58,6 +58,18 @@ CmkIcon * cmk_icon_new_full(const gchar *iconName, const gchar *themeName, gfloa
 void cmk_icon_set_icon(CmkIcon *icon, const gchar *iconName);
 const gchar * cmk_icon_get_icon(CmkIcon *icon);
 
+/**
+ * cmk_icon_set_from_content_type:
+ *
+ * Shows the icon for a content type (such as "text/plain" or one from
+ * g_file_info_get_content_type()) instead of a named icon. The icon is
+ * resolved with cmk_icon_loader_lookup_content_type(), which remembers
+ * each type, so many icons of the same type only look it up once.
+ * Setting an icon name clears this, and vice versa.
+ */
+void cmk_icon_set_from_content_type(CmkIcon *icon, const gchar *contentType);
+const gchar * cmk_icon_get_content_type(CmkIcon *icon);
+
 /**
  * cmk_icon_set_pixmap:
  * @icon: The icon
@@ -67,8 +79,8 @@ const gchar * cmk_icon_get_icon(CmkIcon *icon);
  * @format: The pixel format of the data buffer
  * @size: Size in pixels of the icon. This is NOT scaled by the current
  *        dp; you must specify a scaled icon manually.
- * @frames: Number of frames of images in the animation. (Current unsupported)
- * @fps: Frames per second of the animation (Currently unsupported)
+ * @frames: Number of frames of images in the animation
+ * @fps: Frames per second of the animation
  *
  * Instead of using a named icon, use a pixel buffer (or animation). For a
  * static image, set frames to 1. Otherwise, buf should contain a sequence
@@ -79,10 +91,55 @@ const gchar * cmk_icon_get_icon(CmkIcon *icon);
  * The stride of the data buffer must be appropriate for the given format
  * and size.
  *
- * TODO: Animation not yet supported. Only the first frame will be used.
+ * All frames are uploaded to the GPU once, and the animation loops on the
+ * stage's frame clock while the icon is mapped, only moving texture
+ * coordinates each frame. The data is not used after this returns.
  */
 void cmk_icon_set_pixmap(CmkIcon *icon, guchar *data, cairo_format_t format, guint size, guint frames, guint fps);
 
+/**
+ * CmkPixmapFormat:
+ * @CMK_PIXMAP_FORMAT_ARGB32: Premultiplied native-endian ARGB, the same as
+ *                            CAIRO_FORMAT_ARGB32
+ * @CMK_PIXMAP_FORMAT_A8: 8-bit alpha only, the same as CAIRO_FORMAT_A8
+ * @CMK_PIXMAP_FORMAT_RGBA: Straight (not premultiplied) alpha, in byte
+ *                          order R, G, B, A, as from most image decoders
+ *                          and D-Bus tray icons once byte-swapped
+ */
+typedef enum
+{
+	CMK_PIXMAP_FORMAT_ARGB32,
+	CMK_PIXMAP_FORMAT_A8,
+	CMK_PIXMAP_FORMAT_RGBA,
+} CmkPixmapFormat;
+
+/**
+ * cmk_icon_set_pixmap_full:
+ * @icon: The icon
+ * @data: The pixel data, laid out as for cmk_icon_set_pixmap()
+ * @destroy: Called on @data once it is no longer needed, or %NULL
+ * @format: The pixel format of @data
+ * @size: Size in pixels of each frame
+ * @frames: Number of frames
+ * @fps: Frames per second of the animation
+ *
+ * Like cmk_icon_set_pixmap(), but meant for pixmaps that are replaced
+ * often, such as tray and notification icons. A still image in a
+ * premultiplied format is uploaded to the GPU straight from @data with no
+ * intermediate copy, and straight RGBA data is premultiplied once on the
+ * way, using SIMD where available. @destroy is called before this
+ * returns.
+ */
+void cmk_icon_set_pixmap_full(CmkIcon *icon, const guchar *data, GDestroyNotify destroy, CmkPixmapFormat format, guint size, guint frames, guint fps);
+
+/**
+ * cmk_icon_set_pixmap_bytes:
+ *
+ * Like cmk_icon_set_pixmap_full(), but takes the data from @bytes, which
+ * is not referenced after this returns.
+ */
+void cmk_icon_set_pixmap_bytes(CmkIcon *icon, GBytes *bytes, CmkPixmapFormat format, guint size, guint frames, guint fps);
+
 /**
  * cmk_icon_set_size:
  *
@@ -98,11 +155,50 @@ gfloat cmk_icon_get_size(CmkIcon *icon);
  * If the icon is set to use the foreground color, it will mask the entire
  * icon with the current foreground (font) color. This is useful for icons
  * which are solid-colored and should match the current theme, but should
- * not be used on, for example, application icons.
+ * not be used on, for example, application icons. Only the icon's alpha
+ * channel is loaded in this mode (see cmk_icon_loader_load_mask()), and
+ * it is tinted on the GPU, so changes to the foreground color don't
+ * reload or re-upload the icon.
  */
 void cmk_icon_set_use_foreground_color(CmkIcon *icon, gboolean useForeground);
 gboolean cmk_icon_get_use_foreground_color(CmkIcon *icon);
 
+/**
+ * cmk_icon_set_load_synchronously:
+ *
+ * By default, named icons are looked up and loaded on a background
+ * thread once the icon is mapped, and fade in when ready. Meanwhile,
+ * nothing (or the placeholder color) is drawn. If @sync is %TRUE, the
+ * icon is instead loaded during its first paint, blocking that frame,
+ * so it never appears late. Use this for icons that must be present in
+ * the very first frame of a window.
+ */
+void cmk_icon_set_load_synchronously(CmkIcon *icon, gboolean sync);
+gboolean cmk_icon_get_load_synchronously(CmkIcon *icon);
+
+/**
+ * cmk_icon_set_placeholder_color:
+ *
+ * Sets a named color (see cmk_widget_set_named_color()) to fill the
+ * icon's square with while it loads in the background. %NULL, the
+ * default, draws nothing.
+ */
+void cmk_icon_set_placeholder_color(CmkIcon *icon, const gchar *namedColor);
+const gchar * cmk_icon_get_placeholder_color(CmkIcon *icon);
+
+/**
+ * cmk_icon_set_animate_size:
+ *
+ * Set this on icons whose size is animated, such as in a magnifying
+ * dock. Normally every size change loads the icon again at the new size.
+ * With @animate set, the icon also keeps copies of itself at 16, 32, 64,
+ * 128 and 256 pixels, and while the size changes it draws the smallest
+ * copy at least as large as the icon, scaled by the GPU. The icon is
+ * loaded at its exact size only once the size has stopped changing.
+ */
+void cmk_icon_set_animate_size(CmkIcon *icon, gboolean animate);
+gboolean cmk_icon_get_animate_size(CmkIcon *icon);
+
 /**
  * cmk_icon_set_icon_theme:
  *
@@ -112,6 +208,38 @@ gboolean cmk_icon_get_use_foreground_color(CmkIcon *icon);
 void cmk_icon_set_icon_theme(CmkIcon *icon, const gchar *themeName);
 const gchar * cmk_icon_get_icon_theme(CmkIcon *icon);
 
+/**
+ * CmkIconTextureStats:
+ * @atlasPages: Number of atlas textures
+ * @atlasIcons: Number of icon images packed into them
+ * @atlasOccupancy: Fraction (0 to 1) of the atlas pixels holding images
+ * @standaloneTextures: Icon images with a texture of their own, because
+ *                      they're too big for the atlas or are pixmaps
+ * @iconsDrawn: Icons painted since cmk_icon_reset_draw_stats()
+ * @textureSwitches: How often an icon was drawn from a different texture
+ *                   than the icon before it. Cogl can only batch icons
+ *                   drawn one after another from the same texture, so
+ *                   this is a lower bound on the draw calls for them;
+ *                   anything else drawn in between, such as labels, also
+ *                   ends a batch but isn't seen here.
+ *
+ * Icon images of 128 pixels or less that are loaded from icon themes are
+ * packed into shared atlas textures. These numbers show how well that is
+ * working.
+ */
+typedef struct
+{
+	guint atlasPages;
+	guint atlasIcons;
+	gdouble atlasOccupancy;
+	guint standaloneTextures;
+	guint iconsDrawn;
+	guint textureSwitches;
+} CmkIconTextureStats;
+
+void cmk_icon_get_texture_stats(CmkIconTextureStats *stats);
+void cmk_icon_reset_draw_stats(void);
+
 G_END_DECLS
 
 #endif